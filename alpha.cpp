@@ -0,0 +1,116 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <ratio>
+#include <vector>
+
+#include "set.hpp"
+
+// height versus insertion and lookup cost, for a range of alpha values
+template <std::intmax_t N, std::intmax_t D>
+struct policy: xsg::default_policy
+{
+  static constexpr bool sized{true};
+  using alpha = std::ratio<N, D>;
+};
+
+struct deferred_policy: xsg::default_policy
+{
+  static constexpr bool deferred{true};
+};
+
+//////////////////////////////////////////////////////////////////////////////
+template <class P>
+double insert_cost(std::vector<unsigned> const& keys)
+{
+  using timer_t = std::chrono::high_resolution_clock;
+
+  xsg::set<unsigned, std::compare_three_way, std::allocator<unsigned>, P> s;
+
+  auto const t0(timer_t::now());
+
+  for (auto const k: keys) s.insert(k);
+
+  return std::chrono::duration<double>(timer_t::now() - t0).count() * 1e9 /
+    keys.size();
+}
+
+bool check_deferred(std::vector<unsigned> const& keys)
+{ // deferred insertions, without sized nodes, must not walk whole subtrees
+  auto const ti(insert_cost<xsg::default_policy>(keys));
+  auto const td(insert_cost<deferred_policy>(keys));
+
+  std::cout << "  insert " << ti << " ns, deferred " << td << " ns" <<
+    std::endl;
+
+  return td < 4 * ti + 100;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+template <std::intmax_t N, std::intmax_t D>
+void bench(std::vector<unsigned> const& keys)
+{
+  using timer_t = std::chrono::high_resolution_clock;
+
+  xsg::set<unsigned, std::compare_three_way, std::allocator<unsigned>,
+    policy<N, D>> s;
+
+  auto t0(timer_t::now());
+
+  for (auto const k: keys) s.insert(k);
+
+  auto const ti(std::chrono::duration<double>(timer_t::now() - t0).count());
+
+  t0 = timer_t::now();
+
+  std::size_t c{};
+  for (auto const k: keys) c += s.contains(k);
+
+  auto const tf(std::chrono::duration<double>(timer_t::now() - t0).count());
+
+  std::cout << "  alpha " << N << '/' << D <<
+    ": height " << xsg::detail::height(s.root(), {}) <<
+    ", insert " << ti * 1e9 / keys.size() << " ns" <<
+    ", find " << tf * 1e9 / c << " ns" << std::endl;
+}
+
+void bench(char const* const name, std::vector<unsigned> const& keys)
+{
+  std::cout << name << " (" << keys.size() << " keys)" << std::endl;
+
+  bench<4, 7>(keys); // 0.57
+  bench<2, 3>(keys); // the default
+  bench<3, 4>(keys);
+  bench<4, 5>(keys);
+  bench<9, 10>(keys);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int main()
+{
+  constexpr std::size_t n{1 << 20};
+
+  std::mt19937 g(1);
+  std::vector<unsigned> keys(n);
+
+  for (auto& k: keys) k = g();
+  bench("random", keys);
+
+  std::cout << "deferred, without sized nodes" << std::endl;
+
+  if (!check_deferred({keys.begin(), keys.begin() + (1 << 16)}))
+  {
+    std::cout << "deferred insertions are too slow" << std::endl;
+
+    return 1;
+  }
+
+  for (std::size_t i{}; n != i; ++i) keys[i] = i;
+  bench("ascending", keys);
+
+  // runs of ascending keys starting at random points
+  for (std::size_t i{}; n != i; ++i) keys[i] = i % 64 ? keys[i - 1] + 1 : g();
+  bench("clustered", keys);
+
+  return 0;
+}
@@ -2,21 +2,21 @@
 iterator begin() noexcept
 {
   return root_ ?
-    iterator(&root_, detail::first_node(root_, {})) :
-    iterator(&root_);
+    iterator(this, detail::first_node(root_, {})) :
+    iterator(this);
 }
 
-iterator end() noexcept { return iterator(&root_); }
+iterator end() noexcept { return iterator(this); }
 
 // const iterators
 const_iterator begin() const noexcept
 {
   return root_ ?
-    const_iterator(&root_, detail::first_node(root_, {})) :
-    const_iterator(&root_);
+    const_iterator(this, detail::first_node(root_, {})) :
+    const_iterator(this);
 }
 
-const_iterator end() const noexcept { return const_iterator(&root_); }
+const_iterator end() const noexcept { return const_iterator(this); }
 
 auto cbegin() const noexcept { return begin(); }
 auto cend() const noexcept { return end(); }
@@ -24,29 +24,29 @@ auto cend() const noexcept { return end(); }
 // reverse iterators
 reverse_iterator rbegin() noexcept
 {
-  return reverse_iterator(iterator(&root_));
+  return reverse_iterator(iterator(this));
 }
 
 reverse_iterator rend() noexcept
 {
   return root_ ?
-    reverse_iterator(iterator(&root_, detail::first_node(root_, {}))) :
-    reverse_iterator(iterator(&root_));
+    reverse_iterator(iterator(this, detail::first_node(root_, {}))) :
+    reverse_iterator(iterator(this));
 }
 
 // const reverse iterators
 const_reverse_iterator rbegin() const noexcept
 {
-  return const_reverse_iterator(const_iterator(&root_));
+  return const_reverse_iterator(const_iterator(this));
 }
 
 const_reverse_iterator rend() const noexcept
 {
   return root_ ?
     const_reverse_iterator(
-      const_iterator(&root_, detail::first_node(root_, {}))
+      const_iterator(this, detail::first_node(root_, {}))
     ) :
-    const_reverse_iterator(const_iterator(&root_));
+    const_reverse_iterator(const_iterator(this));
 }
 
 auto crbegin() const noexcept { return rbegin(); }
@@ -54,19 +54,51 @@ auto crend() const noexcept { return rend(); }
 
 // self-assign neglected
 auto& operator=(this_class const& o)
-  noexcept(noexcept(clear(), insert(o.begin(), o.end())))
   requires(std::is_copy_constructible_v<value_type>)
 {
-  if (this != &o) clear(), insert(o.begin(), o.end());
+  if (this != &o)
+  {
+    clear();
+
+    if constexpr(std::allocator_traits<
+      node_allocator>::propagate_on_container_copy_assignment::value)
+    {
+      alloc_ = o.alloc_;
+    }
+
+    cmp_ = o.cmp_;
+    root_ = node::clone(alloc_, o.root_); n_ = o.n_; m_ = o.m_;
+  }
 
   return *this;
 }
 
 auto& operator=(this_class&& o)
-  noexcept(noexcept(detail::destroy(root_, {})))
+  noexcept(std::allocator_traits<
+    node_allocator>::propagate_on_container_move_assignment::value ||
+    std::allocator_traits<node_allocator>::is_always_equal::value)
 {
-  detail::destroy(root_, {});
-  detail::assign(root_, o.root_)(o.root_, nullptr);
+  using traits = std::allocator_traits<node_allocator>;
+
+  clear(); cmp_ = o.cmp_;
+
+  if constexpr(traits::propagate_on_container_move_assignment::value)
+  {
+    if (this != &o) alloc_ = std::move(o.alloc_);
+  }
+  else if constexpr(!traits::is_always_equal::value)
+  {
+    if (alloc_ != o.alloc_)
+    { // nodes cannot change hands, move the elements instead
+      insert(std::make_move_iterator(o.begin()),
+        std::make_move_iterator(o.end()));
+      o.clear();
+
+      return *this;
+    }
+  }
+
+  detail::assign(root_, n_, m_, o.root_)(o.root_, o.n_, o.m_, nullptr);
 
   return *this;
 }
@@ -101,6 +133,10 @@ friend auto operator<=>(this_class const& l, this_class const& r)
     );
 }
 
+//
+auto get_allocator() const noexcept { return allocator_type(alloc_); }
+auto key_comp() const noexcept { return cmp_; }
+
 //
 auto root() const noexcept { return root_; }
 
@@ -110,53 +146,55 @@ static constexpr size_type max_size() noexcept
   return ~size_type{} / sizeof(node*);
 }
 
-void clear() noexcept(noexcept(detail::destroy(root_, {})))
+void clear() noexcept
 {
-  detail::destroy(root_, {}); root_ = {};
+  detail::destroy(alloc_, root_); n_ = m_ = {};
 }
 
 bool empty() const noexcept { return !root_; }
 
 void swap(this_class& o) noexcept
 {
-  detail::assign(root_, o.root_)(o.root_, root_);
+  if constexpr(std::allocator_traits<
+    node_allocator>::propagate_on_container_swap::value)
+  {
+    std::swap(alloc_, o.alloc_);
+  }
+
+  std::swap(cmp_, o.cmp_);
+  detail::assign(root_, n_, m_, o.root_, o.n_, o.m_)(
+    o.root_, o.n_, o.m_, root_, n_, m_
+  );
 }
 
 //
 template <int = 0>
 bool contains(auto const& k) const noexcept
-  requires(detail::Comparable<Compare, key_type, decltype(k)>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
-  return std::get<0>(detail::find(root_, {}, k));
+  return std::get<0>(detail::find(root_, {}, detail::key_view(k), cmp_));
 }
 
-auto contains(key_type const k) const noexcept { return contains<0>(k); }
-
-//
-iterator erase(const_iterator a, const_iterator const b)
-  noexcept(noexcept(erase(a)))
-{
-  while (a != b) { a = erase(a); } return {&root_, a.n(), a.p()};
-}
+auto contains(key_type const& k) const noexcept { return contains<0>(k); }
 
 //
 template <int = 0>
 iterator find(auto const& k) noexcept
-  requires(detail::Comparable<Compare, key_type, decltype(k)>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
-  return {&root_, detail::find(root_, {}, k)};
+  return {this, detail::find(root_, {}, detail::key_view(k), cmp_)};
 }
 
-auto find(key_type const k) noexcept { return find<0>(k); }
+auto find(key_type const& k) noexcept { return find<0>(k); }
 
 template <int = 0>
 const_iterator find(auto const& k) const noexcept
-  requires(detail::Comparable<Compare, key_type, decltype(k)>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
-  return {&root_, detail::find(root_, {}, k)};
+  return {this, detail::find(root_, {}, detail::key_view(k), cmp_)};
 }
 
-auto find(key_type const k) const noexcept { return find<0>(k); }
+auto find(key_type const& k) const noexcept { return find<0>(k); }
 
 //
 void insert(std::initializer_list<value_type> const l)
@@ -169,21 +207,21 @@ void insert(std::initializer_list<value_type> const l)
 //
 template <int = 0>
 iterator lower_bound(auto const& k) noexcept
-  requires(detail::Comparable<Compare, decltype(k), key_type>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
   return std::get<0>(equal_range(k));
 }
 
-auto lower_bound(key_type const k) noexcept { return lower_bound<0>(k); }
+auto lower_bound(key_type const& k) noexcept { return lower_bound<0>(k); }
 
 template <int = 0>
 const_iterator lower_bound(auto const& k) const noexcept
-  requires(detail::Comparable<Compare, decltype(k), key_type>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
   return std::get<0>(equal_range(k));
 }
 
-auto lower_bound(key_type const k) const noexcept
+auto lower_bound(key_type const& k) const noexcept
 {
   return lower_bound<0>(k);
 }
@@ -191,21 +229,21 @@ auto lower_bound(key_type const k) const noexcept
 //
 template <int = 0>
 iterator upper_bound(auto const& k) noexcept
-  requires(detail::Comparable<Compare, decltype(k), key_type>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
   return std::get<1>(equal_range(k));
 }
 
-auto upper_bound(key_type const k) noexcept { return upper_bound<0>(k); }
+auto upper_bound(key_type const& k) noexcept { return upper_bound<0>(k); }
 
 template <int = 0>
 const_iterator upper_bound(auto const& k) const noexcept
-  requires(detail::Comparable<Compare, decltype(k), key_type>)
+  requires(detail::Lookup<Compare, decltype(k), key_type>)
 {
   return std::get<1>(equal_range(k));
 }
 
-auto upper_bound(key_type const k) const noexcept
+auto upper_bound(key_type const& k) const noexcept
 {
   return upper_bound<0>(k);
 }
@@ -0,0 +1,321 @@
+#ifndef XSG_FROZEN_HPP
+# define XSG_FROZEN_HPP
+# pragma once
+
+#include "utils.hpp"
+
+#include "frozeniterator.hpp"
+
+namespace xsg
+{
+
+// A read-only snapshot of a map or a set, as their freeze() returns it. The
+// elements are copied into a single array, laid out as a complete binary
+// search tree in breadth-first order (the Eytzinger layout): the children of
+// the k-th element, counting from 1, are the 2k-th and the (2k+1)-th. There
+// are no links to follow, a search only computes the next index from the
+// outcome of each comparison, without branching on it, and the top levels of
+// the tree share a few cache lines.
+template <typename Key, typename T, class Compare, class Allocator>
+class frozen
+{
+public:
+  using key_type = Key;
+  using value_type = T;
+  using allocator_type = Allocator;
+
+  using difference_type = detail::difference_type;
+  using size_type = detail::size_type;
+  using reference = value_type const&;
+  using const_reference = value_type const&;
+
+  using iterator = frozeniterator<frozen>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_iterator = iterator;
+  using const_reverse_iterator = reverse_iterator;
+
+private:
+  friend iterator;
+
+  using alloc_t = typename std::allocator_traits<Allocator>::template
+    rebind_alloc<value_type>;
+  using traits = std::allocator_traits<alloc_t>;
+
+  value_type* a_{};
+  size_type n_{};
+
+  [[no_unique_address]] Compare cmp_;
+  [[no_unique_address]] alloc_t alloc_;
+
+  static auto& key(value_type const& v) noexcept
+  {
+    if constexpr(std::same_as<Key, T>) return v; else return std::get<0>(v);
+  }
+
+  // the indices of the first and last elements in order, 0 if there are none
+  auto first() const noexcept { return std::bit_floor(n_); }
+  auto last() const noexcept { return std::bit_floor(n_ + 1) - 1; }
+
+  size_type next(size_type i) const noexcept
+  { // the leftmost element of the right subtree, else the first ancestor
+    // reached from a left child
+    if ((i = 2 * i + 1) <= n_)
+    {
+      for (; 2 * i <= n_; i *= 2);
+
+      return i;
+    }
+
+    return i >> (std::countr_one(i) + 1);
+  }
+
+  size_type prev(size_type i) const noexcept
+  { // the mirror image of next()
+    if (2 * i <= n_)
+    {
+      for (i *= 2; 2 * i + 1 <= n_; i = 2 * i + 1);
+
+      return i;
+    }
+
+    return i >> (std::countr_zero(i) + 1);
+  }
+
+  size_type lower(auto const& k) const noexcept
+  { // the first element not less than k, the turns taken (1 for right) are
+    // the bits of i, the trailing right turns after the last left one undone
+    size_type i(1);
+
+    while (i <= n_) i = 2 * i + (cmp_(k, key(a_[i - 1])) > 0);
+
+    return i >> (std::countr_one(i) + 1);
+  }
+
+  size_type upper(auto const& k) const noexcept
+  { // the first element greater than k
+    size_type i(1);
+
+    while (i <= n_) i = 2 * i + (cmp_(k, key(a_[i - 1])) >= 0);
+
+    return i >> (std::countr_one(i) + 1);
+  }
+
+public:
+  frozen() = default;
+
+  explicit frozen(auto const& c)
+    requires(!std::same_as<std::remove_cvref_t<decltype(c)>, frozen>):
+    n_(c.size()),
+    cmp_(c.key_comp()),
+    alloc_(c.get_allocator())
+  { // c iterates its elements in order
+    if (!n_) return;
+
+    a_ = traits::allocate(alloc_, n_);
+
+    auto i(first());
+
+    try
+    {
+      for (auto& v: c)
+      {
+        traits::construct(alloc_, &a_[i - 1], v);
+        i = next(i);
+      }
+    }
+    catch (...)
+    {
+      for (auto j(first()); j != i; j = next(j))
+      {
+        traits::destroy(alloc_, &a_[j - 1]);
+      }
+
+      traits::deallocate(alloc_, a_, n_);
+
+      throw;
+    }
+  }
+
+  frozen(frozen const& o):
+    n_(o.n_),
+    cmp_(o.cmp_),
+    alloc_(traits::select_on_container_copy_construction(o.alloc_))
+  {
+    if (!n_) return;
+
+    a_ = traits::allocate(alloc_, n_);
+
+    size_type i{};
+
+    try
+    {
+      for (; i != n_; ++i) traits::construct(alloc_, &a_[i], o.a_[i]);
+    }
+    catch (...)
+    {
+      while (i) traits::destroy(alloc_, &a_[--i]);
+
+      traits::deallocate(alloc_, a_, n_);
+
+      throw;
+    }
+  }
+
+  frozen(frozen&& o) noexcept:
+    a_(std::exchange(o.a_, {})),
+    n_(std::exchange(o.n_, {})),
+    cmp_(o.cmp_),
+    alloc_(std::move(o.alloc_))
+  {
+  }
+
+  ~frozen() noexcept
+  {
+    if (a_)
+    {
+      for (auto i(n_); i;) traits::destroy(alloc_, &a_[--i]);
+
+      traits::deallocate(alloc_, a_, n_);
+    }
+  }
+
+  //
+  frozen& operator=(frozen o) noexcept { swap(o); return *this; }
+
+  //
+  void swap(frozen& o) noexcept
+  {
+    std::swap(a_, o.a_);
+    std::swap(n_, o.n_);
+    std::swap(cmp_, o.cmp_);
+    std::swap(alloc_, o.alloc_);
+  }
+
+  //
+  auto get_allocator() const noexcept { return allocator_type(alloc_); }
+  auto key_comp() const noexcept { return cmp_; }
+
+  //
+  bool empty() const noexcept { return !n_; }
+  auto size() const noexcept { return n_; }
+
+  // iterators
+  iterator begin() const noexcept { return {this, first()}; }
+  iterator end() const noexcept { return {this, {}}; }
+
+  auto cbegin() const noexcept { return begin(); }
+  auto cend() const noexcept { return end(); }
+
+  reverse_iterator rbegin() const noexcept { return reverse_iterator(end()); }
+  reverse_iterator rend() const noexcept { return reverse_iterator(begin()); }
+
+  auto crbegin() const noexcept { return rbegin(); }
+  auto crend() const noexcept { return rend(); }
+
+  //
+  template <int = 0>
+  auto& at(auto const& k) const noexcept
+    requires(!std::same_as<Key, T> &&
+      detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return std::get<1>(*find(k));
+  }
+
+  auto& at(key_type const& k) const noexcept
+    requires(!std::same_as<Key, T>)
+  {
+    return at<0>(k);
+  }
+
+  template <int = 0>
+  auto& operator[](auto const& k) const noexcept
+    requires(!std::same_as<Key, T> &&
+      detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return at(k);
+  }
+
+  auto& operator[](key_type const& k) const noexcept
+    requires(!std::same_as<Key, T>)
+  {
+    return at<0>(k);
+  }
+
+  //
+  template <int = 0>
+  bool contains(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return bool(find(k));
+  }
+
+  auto contains(key_type const& k) const noexcept { return contains<0>(k); }
+
+  template <int = 0>
+  size_type count(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return contains(k);
+  }
+
+  auto count(key_type const& k) const noexcept { return count<0>(k); }
+
+  //
+  template <int = 0>
+  auto equal_range(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    auto const& kv(detail::key_view(k));
+
+    return std::pair(iterator(this, lower(kv)), iterator(this, upper(kv)));
+  }
+
+  auto equal_range(key_type const& k) const noexcept
+  {
+    return equal_range<0>(k);
+  }
+
+  template <int = 0>
+  iterator find(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    auto const& kv(detail::key_view(k));
+    auto const i(lower(kv));
+
+    return {this, i && (cmp_(kv, key(a_[i - 1])) == 0) ? i : size_type{}};
+  }
+
+  auto find(key_type const& k) const noexcept { return find<0>(k); }
+
+  template <int = 0>
+  iterator lower_bound(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return {this, lower(detail::key_view(k))};
+  }
+
+  auto lower_bound(key_type const& k) const noexcept
+  {
+    return lower_bound<0>(k);
+  }
+
+  template <int = 0>
+  iterator upper_bound(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return {this, upper(detail::key_view(k))};
+  }
+
+  auto upper_bound(key_type const& k) const noexcept
+  {
+    return upper_bound<0>(k);
+  }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+template <typename K, typename T, class C, class A>
+inline void swap(frozen<K, T, C, A>& l, decltype(l) r) noexcept { l.swap(r); }
+
+}
+
+#endif // XSG_FROZEN_HPP
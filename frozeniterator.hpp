@@ -0,0 +1,68 @@
+#ifndef XSG_FROZENITERATOR_HPP
+# define XSG_FROZENITERATOR_HPP
+# pragma once
+
+#include <iterator>
+#include <type_traits>
+
+namespace xsg
+{
+
+template <typename T>
+class frozeniterator
+{
+  T const* f_;
+  detail::size_type i_; // from 1, 0 is past either end
+
+public:
+  using iterator_category = std::bidirectional_iterator_tag;
+  using difference_type = detail::difference_type;
+  using value_type = typename T::value_type const;
+
+  using pointer = value_type*;
+  using reference = value_type&;
+
+public:
+  frozeniterator() = default;
+
+  frozeniterator(T const* const f, detail::size_type const i) noexcept:
+    f_(f),
+    i_(i)
+  {
+  }
+
+  //
+  bool operator==(frozeniterator const& o) const noexcept
+  {
+    return i_ == o.i_;
+  }
+
+  // increment, decrement
+  auto& operator++() noexcept { i_ = f_->next(i_); return *this; }
+
+  auto& operator--() noexcept
+  {
+    i_ = i_ ? f_->prev(i_) : f_->last(); return *this;
+  }
+
+  frozeniterator operator++(int) noexcept
+  {
+    auto const i(i_); i_ = f_->next(i_); return {f_, i};
+  }
+
+  frozeniterator operator--(int) noexcept
+  {
+    auto const i(i_); i_ = i_ ? f_->prev(i_) : f_->last(); return {f_, i};
+  }
+
+  // member access
+  auto operator->() const noexcept { return &f_->a_[i_ - 1]; }
+  auto& operator*() const noexcept { return f_->a_[i_ - 1]; }
+
+  //
+  explicit operator bool() const noexcept { return i_; }
+};
+
+}
+
+#endif // XSG_FROZENITERATOR_HPP
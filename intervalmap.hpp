@@ -5,12 +5,15 @@
 #include "utils.hpp"
 
 #include "multimapiterator.hpp"
+#include "nodehandle.hpp"
 
 namespace xsg
 {
 
 template <typename Key, typename Value,
-  class Compare = std::compare_three_way>
+  class Compare = std::compare_three_way,
+  class Allocator = std::allocator<std::pair<Key const, Value>>,
+  class Policy = default_policy>
 class intervalmap
 {
 public:
@@ -19,6 +22,7 @@ public:
   using key_type = Key;
   using mapped_type = Value;
   using value_type = std::pair<Key const, Value>;
+  using allocator_type = Allocator;
 
   using difference_type = detail::difference_type;
   using size_type = detail::size_type;
@@ -30,13 +34,17 @@ public:
   using const_iterator = multimapiterator<node const>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
+  using node_type = nodehandle<node,
+    typename std::allocator_traits<Allocator>::template rebind_alloc<node>>;
+
   struct node
   {
     using value_type = intervalmap::value_type;
-
-    static constinit inline Compare const cmp;
+    using policy = Policy;
+    using container = intervalmap;
 
     std::uintptr_t l_, r_;
+    [[no_unique_address]] detail::node_size_t<Policy> s_;
 
     typename std::tuple_element_t<1, Key> m_;
     xl::list<value_type> v_;
@@ -70,7 +78,8 @@ public:
     }
 
     //
-    static auto emplace(auto& r, auto&& k, auto&& ...a)
+    static auto emplace(auto& al, auto& r, size_type& c, auto const& cmp,
+      auto&& k, auto&& ...a)
       requires(
         detail::Comparable<
           Compare,
@@ -79,125 +88,195 @@ public:
         >
       )
     {
-      enum Direction: bool { LEFT, RIGHT };
+      return link(
+          r,
+          c,
+          k,
+          cmp,
+          [&](node* const p)
+          {
+            auto const q(
+              detail::new_node(
+                al,
+                std::forward<decltype(k)>(k),
+                std::forward<decltype(a)>(a)...
+              )
+            );
+
+            q->l_ = q->r_ = detail::conv(p);
+            if constexpr(Policy::sized) q->s_ = 1;
+
+            return q;
+          },
+          [&](node* const n)
+          {
+            n->v_.emplace_back(
+              std::piecewise_construct_t{},
+              std::forward_as_tuple(std::forward<decltype(k)>(k)),
+              std::forward_as_tuple(std::forward<decltype(a)>(a)...)
+            );
+          }
+        );
+    }
+
+    static auto insert(auto& r, size_type& c, node* const n,
+      auto const& cmp) noexcept
+    { // link a detached node, unless its key is in the tree already
+      n->m_ = node_max(n, cmp);
+
+      auto const [q, qp](
+        link(
+          r,
+          c,
+          std::pair(n->key(), n->m_),
+          cmp,
+          [n](node* const p) noexcept
+          {
+            n->l_ = n->r_ = detail::conv(p);
+            if constexpr(Policy::sized) n->s_ = 1;
+
+            return n;
+          },
+          [](node*) noexcept {}
+        )
+      );
+
+      return std::tuple(q, qp, n == q);
+    }
 
+    // k is an interval, create_node() makes the node for a new key, while
+    // append() adds the interval to the node of an existing one, c counts
+    // the nodes, see detail::emplace()
+    static auto link(auto& r, size_type& c, auto const& k, auto const& cmp,
+      auto const& create_node, auto const& append)
+    {
       auto const& [mink, maxk](k);
 
-      node* q, *qp;
+      if (r)
+      {
+        auto const [q, qp, s](
+          detail::emplace(
+            r,
+            mink,
+            cmp,
+            create_node,
+            [&](auto const n, decltype(n) l, decltype(n) r) noexcept
+            {
+              fix(n, l, r, cmp);
+            },
+            [&](node* const n) noexcept
+            {
+              n->m_ = cmp(n->m_, maxk) < 0 ? maxk : n->m_;
+            },
+            append,
+            c
+          )
+        );
+
+        return std::pair(q, qp);
+      }
+      else
+      {
+        node* qp;
+
+        r = create_node(qp = {}); c = 1;
+
+        return std::pair(r, qp);
+      }
+    }
+
+    static auto emplace_hint(auto& al, auto& r, size_type& c, auto const& cmp,
+      node* const n, node* const p, auto&& k, auto&& ...a)
+      requires(
+        detail::Comparable<
+          Compare,
+          decltype(std::get<0>(k)),
+          decltype(node::m_)
+        >
+      )
+    {
+      if (!r) return emplace(al, r, c, cmp, std::forward<decltype(k)>(k),
+        std::forward<decltype(a)>(a)...);
+
+      auto const& [mink, maxk](k);
 
-      auto const create_node([&](decltype(q) const p)
+      auto const create_node([&](node* const p)
         {
           auto const q(
-            new node(
+            detail::new_node(
+              al,
               std::forward<decltype(k)>(k),
               std::forward<decltype(a)>(a)...
             )
           );
 
           q->l_ = q->r_ = detail::conv(p);
+          if constexpr(Policy::sized) q->s_ = 1;
 
           return q;
         }
       );
 
-      auto const f([&](auto&& f, auto const n, decltype(n) p,
-        enum Direction const d) -> size_type
-        {
-          n->m_ = cmp(n->m_, maxk) < 0 ? maxk : n->m_;
-
-          //
-          size_type sl, sr;
-
-          if (auto const c(cmp(mink, n->key())); c < 0)
+      auto const [q, qp, s](
+        detail::emplace(
+          r,
+          n,
+          p,
+          mink,
+          cmp,
+          create_node,
+          [&](auto const n, auto const l, auto const r) noexcept
           {
-            if (auto const l(detail::left_node(n, p)); l)
-            {
-              if (auto const sz(f(f, l, n, LEFT)); sz)
-              {
-                sl = sz;
-              }
-              else
-              {
-                return {};
-              }
-            }
-            else
-            {
-              sl = bool(q = create_node(qp = n));
-              n->l_ = detail::conv(q, p);
-            }
-
-            sr = detail::size(detail::right_node(n, p), n);
-          }
-          else if (c > 0)
+            fix(n, l, r, cmp);
+          },
+          [&](auto const n) noexcept
           {
-            if (auto const r(detail::right_node(n, p)); r)
-            {
-              if (auto const sz(f(f, r, n, RIGHT)); sz)
-              {
-                sr = sz;
-              }
-              else
-              {
-                return {};
-              }
-            }
-            else
-            {
-              sr = bool(q = create_node(qp = n));
-              n->r_ = detail::conv(q, p);
-            }
-
-            sl = detail::size(detail::left_node(n, p), n);
-          }
-          else
+            n->m_ = cmp(n->m_, maxk) < 0 ? maxk : n->m_;
+          },
+          [&]
           {
-            (qp = p, q = n)->v_.emplace_back(
-              std::piecewise_construct_t{},
-              std::forward_as_tuple(std::forward<decltype(k)>(k)),
-              std::forward_as_tuple(std::forward<decltype(a)>(a)...)
+            auto const [q, qp](
+              emplace(
+                al,
+                r,
+                c,
+                cmp,
+                std::forward<decltype(k)>(k),
+                std::forward<decltype(a)>(a)...
+              )
             );
 
-            return {};
-          }
-
-          //
-          if (auto const s(1 + sl + sr), S(2 * s);
-            (3 * sl > S) || (3 * sr > S))
-          {
-            if (auto const nn(rebalance(n, p, q, qp, s)); p)
-            {
-              d ?
-                p->r_ = detail::conv(nn, detail::right_node(p, n)) :
-                p->l_ = detail::conv(nn, detail::left_node(p, n));
-            }
-            else
-            {
-              r = nn;
-            }
-
-            return {};
-          }
-          else
-          {
-            return s;
-          }
-        }
+            return std::tuple(q, qp, true);
+          },
+          c
+        )
       );
 
-      if (r)
-      {
-        f(f, r, {}, {});
-      }
-      else
+      if (!s)
       {
-        r = q = create_node(qp = {});
+        q->v_.emplace_back(
+          std::piecewise_construct_t{},
+          std::forward_as_tuple(std::forward<decltype(k)>(k)),
+          std::forward_as_tuple(std::forward<decltype(a)>(a)...)
+        );
+
+        // the new interval may stick out of q and its ancestors
+        for (auto n(q), p(qp);;)
+        {
+          n->m_ = cmp(n->m_, maxk) < 0 ? maxk : n->m_;
+
+          if (!p) break;
+
+          detail::assign(n, p)(p, cmp(n->key(), p->key()) < 0 ?
+            detail::left_node(p, n) : detail::right_node(p, n));
+        }
       }
 
       return std::pair(q, qp);
     }
 
-    inline auto equal_range(auto n, decltype(n) p, auto&& k) noexcept
+    inline auto equal_range(auto n, decltype(n) p, auto&& k,
+      auto const& cmp) noexcept
       requires(
         detail::Comparable<
           Compare,
@@ -207,13 +286,11 @@ public:
       )
 
     {
-      using node = std::remove_const_t<std::remove_pointer_t<decltype(n)>>;
-
       decltype(n) gn{}, gp{};
 
       for (auto const& [mink, maxk](k); n;)
       {
-        if (auto const c(node::cmp(mink, n->key())); c < 0)
+        if (auto const c(cmp(mink, n->key())); c < 0)
         {
           assign(gn, gp, n, p)(n, p, left_node(n, p), n);
         }
@@ -238,17 +315,17 @@ public:
       );
     }
 
-    static iterator erase(auto& r0, const_iterator const i)
+    static iterator erase(container& c, const_iterator const i)
       noexcept(
         noexcept(std::declval<node>().v_.erase(i.i())) &&
-        noexcept(node::erase(r0, i.n(), i.p()))
+        noexcept(node::erase(c.alloc_, c.root_, i.n(), i.p(), c.cmp_))
       )
     {
       if (auto const n(i.n()), p(i.p()); 1 == n->v_.size())
       {
-        auto const [nn, np, s](node::erase(r0, n, p));
+        auto const [nn, np, s](node::erase(c.alloc_, c.root_, n, p, c.cmp_));
 
-        return {&r0, nn, np};
+        return {&c, nn, np};
       }
       else if (auto const it(i.i()); std::next(it) == n->v_.end())
       {
@@ -256,20 +333,21 @@ public:
 
         n->v_.erase(it);
 
-        return {&r0, ni.n(), ni.p()};
+        return {&c, ni.n(), ni.p()};
       }
       else
       {
-        return {&r0, n, p, n->v_.erase(it)};
+        return {&c, n, p, n->v_.erase(it)};
       }
     }
 
-    static inline auto erase(auto& r0, auto const pp, decltype(pp) p,
-      decltype(pp) n, std::uintptr_t* const q)
-      noexcept(noexcept(delete r0))
+    static inline auto unlink(auto& r0, auto const pp, decltype(pp) p,
+      decltype(pp) n, std::uintptr_t* const q, auto const& cmp) noexcept
     {
       size_type const s(n->v_.size());
-      auto [nnn, nnp](detail::next_node(n, p));
+      auto [nnn, nnp](detail::next_node(n, p, cmp));
+
+      detail::shrink_path(n, p, cmp);
 
       // pp - p - n - lr
       if (auto const l(detail::left_node(n, p)),
@@ -279,6 +357,17 @@ public:
         {
           auto const [fnn, fnp](detail::first_node(r, n));
 
+          if constexpr(Policy::sized)
+          {
+            fnn->s_ = n->s_ - 1;
+
+            for (auto m(r), mp(n); fnn != m;
+              detail::assign(m, mp)(detail::left_node(m, mp), m))
+            {
+              --m->s_;
+            }
+          }
+
           if (fnn == nnn)
           {
             nnp = p;
@@ -305,7 +394,7 @@ public:
           {
             r->r_ ^= detail::conv(n, p);
 
-            reset_max(r0, r->key());
+            reset_max(r0, r->key(), cmp);
           }
           else
           {
@@ -331,13 +420,24 @@ public:
               r->l_ ^= nfnn; r->r_ ^= nfnn;
             }
 
-            reset_max(r0, fnp->key());
+            reset_max(r0, fnp->key(), cmp);
           }
         }
         else // erase from the left side
         {
           auto const [lnn, lnp](detail::last_node(l, n));
 
+          if constexpr(Policy::sized)
+          {
+            lnn->s_ = n->s_ - 1;
+
+            for (auto m(l), mp(n); lnn != m;
+              detail::assign(m, mp)(detail::right_node(m, mp), m))
+            {
+              --m->s_;
+            }
+          }
+
           if (r == nnn)
           {
             nnp = lnn;
@@ -364,7 +464,7 @@ public:
           {
             l->l_ ^= detail::conv(n, p);
 
-            reset_max(r0, l->key());
+            reset_max(r0, l->key(), cmp);
           }
           else
           {
@@ -389,7 +489,7 @@ public:
               l->l_ ^= nlnn; l->r_ ^= nlnn;
             }
 
-            reset_max(r0, lnp->key());
+            reset_max(r0, lnp->key(), cmp);
           }
         }
       }
@@ -412,7 +512,7 @@ public:
         {
           *q = detail::conv(lr, pp);
 
-          reset_max(r0, p->key());
+          reset_max(r0, p->key(), cmp);
         }
         else
         {
@@ -420,13 +520,22 @@ public:
         }
       }
 
-      delete n;
-
       return std::tuple(nnn, nnp, s);
     }
 
-    static auto erase(auto& r0, auto&& k)
-      noexcept(noexcept(erase(r0, r0, r0, r0, {})))
+    static inline auto erase(auto& al, auto& r0, auto const pp,
+      decltype(pp) p, decltype(pp) n, std::uintptr_t* const q,
+      auto const& cmp) noexcept
+    {
+      auto const r(unlink(r0, pp, p, n, q, cmp));
+
+      detail::delete_node(al, n);
+
+      return r;
+    }
+
+    static auto erase(auto& al, auto& r0, auto&& k, auto const& cmp)
+      noexcept(noexcept(erase(al, r0, r0, r0, r0, {}, cmp)))
       requires(
         detail::Comparable<
           Compare,
@@ -436,14 +545,13 @@ public:
       )
     {
       using pointer = std::remove_cvref_t<decltype(r0)>;
-      using node = std::remove_pointer_t<pointer>;
 
       auto const& [mink, maxk](k);
       std::uintptr_t* q{};
 
       for (pointer pp{}, p{}, n(r0); n;)
       {
-        if (auto const c(node::cmp(mink, n->key())); c < 0)
+        if (auto const c(cmp(mink, n->key())); c < 0)
         {
           detail::assign(pp, p, n, q)(p, n, detail::left_node(n, p), &n->l_);
         }
@@ -453,33 +561,42 @@ public:
         }
         else
         {
-          return erase(r0, pp, p, n, q);
+          return erase(al, r0, pp, p, n, q, cmp);
         }
       }
 
       return std::tuple(pointer{}, pointer{}, size_type{});
     }
 
-    static auto erase(auto& r0, auto const n, decltype(n) const p)
-      noexcept(noexcept(erase(r0, r0, r0, r0, {})))
+    static auto unlink(auto& r0, auto const n, decltype(n) const p,
+      auto const& cmp) noexcept
     {
       using pointer = std::remove_cvref_t<decltype(r0)>;
-      using node = std::remove_pointer_t<pointer>;
 
       pointer pp{};
       std::uintptr_t* q{};
 
       if (p)
       {
-        node::cmp(n->key(), p->key()) < 0 ?
+        cmp(n->key(), p->key()) < 0 ?
           detail::assign(pp, q)(detail::left_node(p, n), &p->l_) :
           detail::assign(pp, q)(detail::right_node(p, n), &p->r_);
       }
 
-      return erase(r0, pp, p, n, q);
+      return unlink(r0, pp, p, n, q, cmp);
     }
 
-    static auto node_max(auto const n) noexcept
+    static auto erase(auto& al, auto& r0, auto const n, decltype(n) const p,
+      auto const& cmp) noexcept(noexcept(erase(al, r0, r0, r0, r0, {}, cmp)))
+    {
+      auto const r(unlink(r0, n, p, cmp));
+
+      detail::delete_node(al, n);
+
+      return r;
+    }
+
+    static auto node_max(auto const n, auto const& cmp) noexcept
     {
       decltype(node::m_) m(n->key());
 
@@ -496,13 +613,13 @@ public:
       return m;
     }
 
-    static void reset_max(auto const r0, auto&& k) noexcept
+    static void reset_max(auto const r0, auto&& k, auto const& cmp) noexcept
       requires(detail::Comparable<Compare, decltype(k), decltype(node::m_)>)
     {
       auto const f([&](auto&& f, auto const n, decltype(n) p) noexcept ->
         decltype(node::m_)
         {
-          auto m(node_max(n));
+          auto m(node_max(n, cmp));
 
           auto const l(detail::left_node(n, p)), r(detail::right_node(n, p));
 
@@ -546,145 +663,215 @@ public:
       f(f, r0, {});
     }
 
-    static auto rebalance(auto const n, decltype(n) p,
-      decltype(n) q, auto& qp, size_type const sz) noexcept
+    static void fix(auto const n, decltype(n) l, decltype(n) r,
+      auto const& cmp) noexcept
     {
-      auto const l(static_cast<node**>(XSG_ALLOCA(sizeof(node*) * sz)));
+      auto m(node_max(n, cmp));
+
+      if (l) m = cmp(m, l->m_) < 0 ? l->m_ : m;
+      if (r) m = cmp(m, r->m_) < 0 ? r->m_ : m;
+
+      n->m_ = m;
 
-/*
+      if constexpr(Policy::sized)
       {
-        auto k(l);
-        auto t(detail::first_node(n, p));
+        n->s_ = 1 + (l ? l->s_ : 0) + (r ? r->s_ : 0);
+      }
+    }
 
-        do
+    static auto rebalance(auto const n, decltype(n) p,
+      decltype(n) q, auto& qp, auto const& cmp) noexcept
+    {
+      return detail::rebalance(n, p, q, qp,
+        [&](auto const n, decltype(n) l, decltype(n) r) noexcept
         {
-          *k++ = std::get<0>(t);
+          fix(n, l, r, cmp);
         }
-        while (std::get<0>(t =
-          detail::next_node(n, std::get<0>(t), std::get<1>(t))));
-      }
-*/
+      );
+    }
 
-      {
-        auto f([l(l)](auto&& f, auto const n,
-          decltype(n) const p) mutable noexcept -> void
+    static auto clone(auto& al, node const* const n)
+    {
+      return detail::clone(
+          al,
+          n,
+          [&](auto const n)
           {
-            if (n)
-            {
-              f(f, detail::left_node(n, p), n);
+            auto const m(
+              detail::new_node(
+                al,
+                std::get<0>(n->v_.front()),
+                std::get<1>(n->v_.front())
+              )
+            );
 
-              *l++ = n;
+            m->m_ = n->m_;
+            try
+            {
+              std::for_each(
+                std::next(n->v_.cbegin()),
+                n->v_.cend(),
+                [&](auto& v) { m->v_.emplace_back(v); }
+              );
+            }
+            catch (...)
+            {
+              detail::delete_node(al, m);
 
-              f(f, detail::right_node(n, p), n);
+              throw;
             }
+
+            return m;
           }
         );
+    }
 
-        f(f, n, p);
-      }
-
-      auto const f([l, q, &qp](auto&& f, auto const p,
-        std::size_t const a, decltype(a) b) noexcept -> node*
-        {
-          auto const i(std::midpoint(a, b));
-          auto const n(l[i]);
-
-          if (n == q)
+    static auto build(auto& al, auto const i, decltype(i) j, auto const& cmp,
+      size_type& c)
+    {
+      return detail::build(
+          al,
+          i,
+          j,
+          [&](auto&& v, node* const t) -> node*
           {
-            qp = p;
-          }
+            if (t && (cmp(std::get<0>(std::get<0>(v)), t->key()) == 0))
+            {
+              t->v_.emplace_back(std::forward<decltype(v)>(v));
 
-          switch (b - a)
+              return {};
+            }
+            else
+            {
+              return detail::new_node(
+                  al,
+                  std::get<0>(std::forward<decltype(v)>(v)),
+                  std::get<1>(std::forward<decltype(v)>(v))
+                );
+            }
+          },
+          [&](auto const n, decltype(n) l, decltype(n) r) noexcept
           {
-            case 0:
-              n->l_ = n->r_ = detail::conv(p);
-
-              n->m_ = node_max(n);
-
-              break;
-
-            case 1:
-              {
-                // n - nb
-                auto const nb(l[b]);
-
-                if (nb == q)
-                {
-                  qp = n;
-                }
-
-                nb->l_ = nb->r_ = detail::conv(n);
-                n->l_ = detail::conv(p); n->r_ = detail::conv(nb, p);
-
-                n->m_ = std::max(
-                    node_max(n),
-                    nb->m_ = node_max(nb),
-                    [](auto&& a, auto&& b) noexcept
-                    {
-                      return node::cmp(a, b) < 0;
-                    }
-                  );
-              }
-
-              break;
+            fix(n, l, r, cmp);
+          },
+          c
+        );
+    }
 
-            default:
-              auto const l(f(f, n, a, i - 1)), r(f(f, n, i + 1, b));
-              detail::assign(n->l_, n->r_)(detail::conv(l, p), detail::conv(r, p));
+    static void insert_batch(auto& al, auto& r, auto const i, decltype(i) j,
+      auto const& cmp)
+    {
+      detail::insert_batch(
+        al,
+        r,
+        i,
+        j,
+        cmp,
+        [](auto&& v) noexcept -> auto& { return std::get<0>(std::get<0>(v)); },
+        [&](auto&& v, node* const t) -> node*
+        {
+          if (t && (cmp(std::get<0>(std::get<0>(v)), t->key()) == 0))
+          {
+            t->v_.emplace_back(v);
 
-              n->m_ = std::max(
-                  {node_max(n), l->m_, r->m_},
-                  [](auto&& a, auto&& b) noexcept
-                  {
-                    return node::cmp(a, b) < 0;
-                  }
-                );
+            return {};
           }
-
-          return n;
+          else
+          {
+            return detail::new_node(al, std::get<0>(v), std::get<1>(v));
+          }
+        },
+        [&](auto const n, decltype(n) l, decltype(n) r) noexcept
+        {
+          fix(n, l, r, cmp);
         }
       );
-
-      //
-      return f(f, p, {}, sz - 1);
     }
   };
 
 private:
   using this_class = intervalmap;
+  using node_allocator = typename std::allocator_traits<
+    Allocator>::template rebind_alloc<node>;
+
+  friend iterator;
+  friend const_iterator;
+
   node* root_{};
+  size_type n_{}; // the nodes in the tree, 0 if not known
+  size_type m_{}; // the most nodes since the last global rebuild
+  [[no_unique_address]] Compare cmp_;
+  [[no_unique_address]] node_allocator alloc_;
 
 public:
   intervalmap() = default;
 
+  explicit intervalmap(Compare const& c, Allocator const& a = Allocator())
+    noexcept(std::is_nothrow_copy_constructible_v<Compare>):
+    cmp_(c),
+    alloc_(a)
+  {
+  }
+
+  explicit intervalmap(Allocator const& a) noexcept: alloc_(a) { }
+
   intervalmap(intervalmap const& o)
-    noexcept(noexcept(*this = o))
-    requires(std::is_copy_constructible_v<value_type>)
+    requires(std::is_copy_constructible_v<value_type>):
+    cmp_(o.cmp_),
+    alloc_(std::allocator_traits<
+      node_allocator>::select_on_container_copy_construction(o.alloc_))
   {
-    *this = o;
+    root_ = node::clone(alloc_, o.root_); n_ = o.n_; m_ = o.m_;
   }
 
-  intervalmap(intervalmap&& o)
-    noexcept(noexcept(*this = std::move(o)))
+  intervalmap(intervalmap&& o) noexcept:
+    root_(std::exchange(o.root_, {})),
+    n_(std::exchange(o.n_, {})),
+    m_(std::exchange(o.m_, {})),
+    cmp_(o.cmp_),
+    alloc_(std::move(o.alloc_))
   {
-    *this = std::move(o);
   }
 
-  intervalmap(std::input_iterator auto const i, decltype(i) j)
-    noexcept(noexcept(insert(i, j)))
+  intervalmap(std::input_iterator auto const i, decltype(i) j,
+    Compare const& c = Compare())
+    noexcept(noexcept(insert(i, j))):
+    cmp_(c)
   {
+    if constexpr(std::forward_iterator<std::remove_const_t<decltype(i)>>)
+    {
+      if (j == std::adjacent_find(i, j, [this](auto&& a, auto&& b) noexcept
+        {
+          return cmp_(std::get<0>(std::get<0>(a)),
+            std::get<0>(std::get<0>(b))) > 0;
+        }))
+      {
+        root_ = node::build(alloc_, i, j, cmp_, n_);
+
+        return;
+      }
+    }
+
     insert(i, j);
   }
 
-  intervalmap(std::initializer_list<value_type> l)
+  intervalmap(sorted_equivalent_t, std::input_iterator auto const i,
+    decltype(i) j, Compare const& c = Compare()):
+    cmp_(c)
+  {
+    root_ = node::build(alloc_, i, j, cmp_, n_);
+  }
+
+  intervalmap(std::initializer_list<value_type> l,
+    Compare const& c = Compare())
     noexcept(noexcept(intervalmap(l.begin(), l.end()))):
-    intervalmap(l.begin(), l.end())
+    intervalmap(l.begin(), l.end(), c)
   {
   }
 
-  ~intervalmap() noexcept(noexcept(delete root_))
+  ~intervalmap() noexcept
   {
-    detail::destroy(root_, {});
+    detail::destroy(alloc_, root_);
   }
 
 # include "common.hpp"
@@ -719,7 +906,7 @@ public:
   {
     for (decltype(root_) p{}, n(root_); n;)
     {
-      if (auto const c(node::cmp(k, n->key())); c < 0)
+      if (auto const c(cmp_(k, n->key())); c < 0)
       {
         detail::assign(n, p)(detail::left_node(n, p), n);
       }
@@ -743,7 +930,10 @@ public:
   iterator emplace(auto&& k, auto&& ...a)
     noexcept(noexcept(
         node::emplace(
+          alloc_,
           root_,
+          n_,
+          cmp_,
           std::forward<decltype(k)>(k),
           std::forward<decltype(a)>(a)...
         )
@@ -752,9 +942,12 @@ public:
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
     return {
-      &root_,
+      this,
       node::emplace(
+        alloc_,
         root_,
+        n_,
+        cmp_,
         std::forward<decltype(k)>(k),
         std::forward<decltype(a)>(a)...
       )
@@ -770,14 +963,38 @@ public:
     return emplace<0>(std::move(k), std::forward<decltype(a)>(a)...);
   }
 
+  template <int = 0>
+  iterator emplace_hint(const_iterator const h, auto&& k, auto&& ...a)
+    requires(detail::Comparable<Compare, decltype(k), key_type>)
+  {
+    return {
+      this,
+      node::emplace_hint(
+        alloc_,
+        root_,
+        n_,
+        cmp_,
+        h.n(),
+        h.p(),
+        std::forward<decltype(k)>(k),
+        std::forward<decltype(a)>(a)...
+      )
+    };
+  }
+
+  auto emplace_hint(const_iterator const h, key_type k, auto&& ...a)
+  {
+    return emplace_hint<0>(h, std::move(k), std::forward<decltype(a)>(a)...);
+  }
+
   //
   template <int = 0>
   auto equal_range(auto&& k) noexcept
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](node::equal_range(root_, {}, k));
+    auto const [nl, g](node::equal_range(root_, {}, k, cmp_));
 
-    return std::pair(iterator(&root_, nl), iterator(&root_, g));
+    return std::pair(iterator(this, nl), iterator(this, g));
   }
 
   auto equal_range(key_type k) noexcept
@@ -789,9 +1006,9 @@ public:
   auto equal_range(auto&& k) const noexcept
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](node::equal_range(root_, {}, k));
+    auto const [nl, g](node::equal_range(root_, {}, k, cmp_));
 
-    return std::pair(const_iterator(&root_, nl), const_iterator(&root_, g));
+    return std::pair(const_iterator(this, nl), const_iterator(this, g));
   }
 
   auto equal_range(key_type k) const noexcept
@@ -802,11 +1019,15 @@ public:
   //
   template <int = 0>
   size_type erase(auto&& k)
-    noexcept(noexcept(node::erase(root_, k)))
+    noexcept(noexcept(node::erase(alloc_, root_, k, cmp_)))
     requires(detail::Comparable<Compare, decltype(k), key_type> &&
       !std::convertible_to<decltype(k), const_iterator>)
   {
-    return std::get<2>(node::erase(root_, k));
+    auto const s(std::get<2>(node::erase(alloc_, root_, k, cmp_)));
+
+    if (s && detail::erased<node>(n_, m_)) rebuild();
+
+    return s;
   }
 
   auto erase(key_type k) noexcept(noexcept(erase<0>(std::move(k))))
@@ -815,33 +1036,330 @@ public:
   }
 
   iterator erase(const_iterator const i)
-    noexcept(noexcept(node::erase(root_, i)))
+    noexcept(noexcept(node::erase(*this, i)))
   {
-    return node::erase(root_, i);
+    auto const s(1 == i.n()->v_.size());
+    iterator const j(node::erase(*this, i));
+
+    if (s && detail::erased<node>(n_, m_))
+    { // the parent of the next node changes
+      rebuild();
+
+      if (auto const n(j.n()); n)
+      {
+        return {this, detail::find(root_, {}, n->key(), cmp_)};
+      }
+    }
+
+    return j;
+  }
+
+  iterator erase(const_iterator const a, const_iterator const b) noexcept
+  { // partial groups at the ends go element by element, the whole groups
+    // in between are cut out as one subtree
+    auto const n(a.n()), m(b.n());
+
+    if (a == b)
+    {
+      return n ?
+        iterator(
+          this,
+          n,
+          a.p(),
+          std::next(n->v_.begin(), std::distance(n->v_.cbegin(), a.i()))
+        ) :
+        end();
+    }
+    else if (n == m)
+    {
+      auto i(n->v_.erase(a.i()));
+      for (; &*i != &*b.i(); i = n->v_.erase(i));
+
+      node::reset_max(root_, n->key(), cmp_);
+
+      return {this, n, a.p(), i};
+    }
+
+    auto const cut([&](auto const& lo, auto const hi) noexcept
+      {
+        detail::erase_range(
+          alloc_,
+          root_,
+          lo,
+          hi,
+          cmp_,
+          [this](auto const n, auto const l, auto const r) noexcept
+          {
+            node::fix(n, l, r, cmp_);
+          },
+          [this](auto& r, auto const n, auto const p) noexcept
+          {
+            node::unlink(r, n, p, cmp_);
+          }
+        );
+
+        n_ = detail::node_count(root_); m_ = {};
+      }
+    );
+
+    auto l(n); // the first node of the cut
+
+    if (n->v_.cbegin() != a.i())
+    {
+      for (auto i(a.i()); n->v_.cend() != i; i = n->v_.erase(i));
+      node::reset_max(root_, n->key(), cmp_);
+
+      l = std::get<0>(detail::next_node(n, a.p(), cmp_));
+    }
+
+    if (m)
+    {
+      auto i(m->v_.begin());
+      for (; &*i != &*b.i(); i = m->v_.erase(i));
+
+      auto const& k(m->key());
+      node::reset_max(root_, k, cmp_);
+
+      if (l != m) cut(l->key(), &k);
+
+      auto const [q, qp](detail::find(root_, {}, k, cmp_));
+
+      return {this, q, qp, i};
+    }
+    else
+    {
+      if (l) cut(l->key(), decltype(&n->key()){});
+
+      return end();
+    }
+  }
+
+  //
+  node_type extract(const_iterator const i) noexcept
+  {
+    auto const n(i.n());
+    node::unlink(root_, n, i.p(), cmp_);
+    if (detail::erased<node>(n_, m_)) rebuild();
+
+    return {n, alloc_};
+  }
+
+  template <int = 0>
+  node_type extract(auto const& k) noexcept
+    requires(detail::Comparable<Compare, decltype(k), key_type> &&
+      !std::convertible_to<decltype(k), const_iterator>)
+  {
+    auto const [n, p](detail::find(root_, {}, std::get<0>(k), cmp_));
+
+    return n ? extract(const_iterator(this, n, p)) : node_type();
+  }
+
+  auto extract(key_type const k) noexcept { return extract<0>(k); }
+
+  // an existing group of equivalent keys takes over the elements, unmoved
+  iterator insert(node_type&& nh) noexcept
+  {
+    if (nh)
+    {
+      auto const n(nh.n_);
+      auto const [q, qp, s](node::insert(root_, n_, n, cmp_));
+
+      if (s)
+      {
+        nh.release();
+      }
+      else
+      {
+        q->v_.splice(q->v_.end(), n->v_);
+
+        nh = {};
+      }
+
+      return {this, q, qp};
+    }
+    else
+    {
+      return end();
+    }
+  }
+
+  // groups of equivalent keys are joined, splicing the elements over
+  void merge(this_class& o) noexcept
+  {
+    detail::merge(
+      root_,
+      o.root_,
+      n_,
+      cmp_,
+      [this](auto const n, auto const l, auto const r) noexcept
+      {
+        node::fix(n, l, r, cmp_);
+      },
+      [this](auto& r, auto& c, auto const n) noexcept
+      {
+        return node::insert(r, c, n, cmp_);
+      },
+      [&](auto const q, auto const n) noexcept
+      {
+        q->v_.splice(q->v_.end(), n->v_);
+
+        detail::delete_node(alloc_, n);
+
+        return true;
+      }
+    );
+
+    o.n_ = detail::node_count(o.root_); m_ = o.m_ = {};
+  }
+
+  void merge(this_class&& o) noexcept { merge(o); }
+
+  // the intervals starting at or after k move into the returned container
+  this_class split(auto const& k) noexcept
+    requires(detail::Comparable<Compare, decltype(k), decltype(node::m_)>)
+  {
+    this_class r(cmp_, alloc_);
+    r.root_ = detail::split(
+        root_,
+        k,
+        cmp_,
+        [this](auto const n, auto const l, auto const r) noexcept
+        {
+          node::fix(n, l, r, cmp_);
+        }
+      );
+
+    r.n_ = detail::node_count(r.root_);
+    n_ = detail::node_count(root_); m_ = {};
+
+    return r;
+  }
+
+  // the intervals of o have to start all before or all after the ones here
+  void join(this_class& o) noexcept
+  {
+    detail::join(
+      root_,
+      o.root_,
+      cmp_,
+      [this](auto const n, auto const l, auto const r) noexcept
+      {
+        node::fix(n, l, r, cmp_);
+      },
+      [this](auto& r, auto const n, auto const p) noexcept
+      {
+        node::unlink(r, n, p, cmp_);
+      }
+    );
+
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  void join(this_class&& o) noexcept { join(o); }
+
+  // rebalance the whole tree, see default_policy::deferred
+  void rebuild() noexcept
+  {
+    detail::rebuild(
+      root_,
+      [this](auto const n, auto const l, auto const r) noexcept
+      {
+        node::fix(n, l, r, cmp_);
+      }
+    );
+
+    m_ = n_;
+  }
+
+  // rebalance scapegoats for at most about budget steps, returns the rest,
+  // a global rebuild due after erasures goes first, if the budget covers it
+  size_type maybe_rebalance(size_type const budget) noexcept
+    requires(Policy::sized)
+  {
+    if (detail::shrunk<node>(n_, m_) && (n_ <= budget))
+    {
+      rebuild();
+
+      return budget - n_;
+    }
+
+    return detail::maybe_rebalance(
+      root_,
+      budget,
+      cmp_,
+      [this](auto const n, auto const l, auto const r) noexcept
+      {
+        node::fix(n, l, r, cmp_);
+      },
+      [this](auto& r, auto const n, auto const p) noexcept
+      {
+        node::unlink(r, n, p, cmp_);
+      }
+    );
+  }
+
+  // the intervals starting in [lo, hi) are erased
+  template <int = 0>
+  void erase_range(auto const& lo, auto const& hi) noexcept
+    requires(detail::Comparable<Compare, decltype(lo), decltype(node::m_)> &&
+      detail::Comparable<Compare, decltype(hi), decltype(node::m_)>)
+  {
+    detail::erase_range(
+      alloc_,
+      root_,
+      lo,
+      &hi,
+      cmp_,
+      [this](auto const n, auto const l, auto const r) noexcept
+      {
+        node::fix(n, l, r, cmp_);
+      },
+      [this](auto& r, auto const n, auto const p) noexcept
+      {
+        node::unlink(r, n, p, cmp_);
+      }
+    );
+
+    n_ = detail::node_count(root_); m_ = {};
   }
 
   //
   iterator insert(value_type const& v)
-    noexcept(noexcept(node::emplace(root_, std::get<0>(v), std::get<1>(v))))
+    noexcept(noexcept(
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v), std::get<1>(v))
+      )
+    )
   {
     return {
-        &root_,
-        node::emplace(root_, std::get<0>(v), std::get<1>(v))
+        this,
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v), std::get<1>(v))
       };
   }
 
   iterator insert(value_type&& v)
     noexcept(noexcept(
-        node::emplace(root_, std::get<0>(v), std::move(std::get<1>(v)))
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v),
+          std::move(std::get<1>(v)))
       )
     )
   {
     return {
-        &root_,
-        node::emplace(root_, std::get<0>(v), std::move(std::get<1>(v)))
+        this,
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v),
+          std::move(std::get<1>(v)))
       };
   }
 
+  iterator insert(const_iterator const h, value_type const& v)
+  {
+    return emplace_hint(h, std::get<0>(v), std::get<1>(v));
+  }
+
+  iterator insert(const_iterator const h, value_type&& v)
+  {
+    return emplace_hint(h, std::get<0>(v), std::move(std::get<1>(v)));
+  }
+
   void insert(std::input_iterator auto const i, decltype(i) j)
     noexcept(noexcept(emplace(std::get<0>(*i), std::get<1>(*i))))
   {
@@ -865,6 +1383,47 @@ public:
     );
   }
 
+  // a sorted range goes in with a single walk, see detail::insert_batch()
+  void insert_batch(std::forward_iterator auto const i, decltype(i) j)
+  {
+    node::insert_batch(alloc_, root_, i, j, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  // the keys in a sorted range are erased with a single walk
+  size_type erase_batch(std::forward_iterator auto const i, decltype(i) j)
+    noexcept
+  {
+    auto const c(
+      detail::erase_batch(
+        root_,
+        i,
+        j,
+        cmp_,
+        [](auto&& k) noexcept -> auto& { return std::get<0>(k); },
+        [this](auto const n, auto const l, auto const r) noexcept
+        {
+          node::fix(n, l, r, cmp_);
+        },
+        [this](auto& r, auto const n, auto const p) noexcept
+        {
+          node::unlink(r, n, p, cmp_);
+        },
+        [&](auto const n) noexcept
+        {
+          size_type const s(n->v_.size());
+          detail::delete_node(alloc_, n);
+
+          return s;
+        }
+      )
+    );
+
+    n_ = detail::node_count(root_); m_ = {};
+
+    return c;
+  }
+
   //
   template <int = 0>
   void all(auto const& k, auto g) const
@@ -872,13 +1431,13 @@ public:
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
     auto& [mink, maxk](k);
-    auto const eq(node::cmp(mink, maxk) == 0);
+    auto const eq(cmp_(mink, maxk) == 0);
 
     auto const f([&](auto&& f, auto const n, decltype(n) p) -> void
       {
-        if (n && (node::cmp(mink, n->m_) < 0))
+        if (n && (cmp_(mink, n->m_) < 0))
         {
-          auto const c(node::cmp(maxk, n->key()));
+          auto const c(cmp_(maxk, n->key()));
 
           if (auto const cg0(c > 0); cg0 || (eq && (c == 0)))
           {
@@ -887,7 +1446,7 @@ public:
               n->v_.cend(),
               [&](auto&& p)
               {
-                if (node::cmp(mink, std::get<1>(std::get<0>(p))) < 0)
+                if (cmp_(mink, std::get<1>(std::get<0>(p))) < 0)
                 {
                   g(std::forward<decltype(p)>(p));
                 }
@@ -919,15 +1478,15 @@ public:
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
     auto& [mink, maxk](k);
-    auto const eq(node::cmp(mink, maxk) == 0);
+    auto const eq(cmp_(mink, maxk) == 0);
 
     node* p{};
 
-    if (auto n(root_); n && (node::cmp(mink, n->m_) < 0))
+    if (auto n(root_); n && (cmp_(mink, n->m_) < 0))
     {
       for (;;)
       {
-        auto const c(node::cmp(maxk, n->key()));
+        auto const c(cmp_(maxk, n->key()));
         auto const cg0(c > 0);
 
         if (cg0 || (eq && (c == 0)))
@@ -937,7 +1496,7 @@ public:
                 n->v_.cend(),
                 [&](auto&& p) noexcept
                 {
-                  return node::cmp(mink, std::get<1>(std::get<0>(p))) < 0;
+                  return cmp_(mink, std::get<1>(std::get<0>(p))) < 0;
                 }
               )
             );
@@ -950,12 +1509,12 @@ public:
 
         //
         if (auto const l(detail::left_node(n, p));
-          l && (node::cmp(mink, l->m_) < 0))
+          l && (cmp_(mink, l->m_) < 0))
         {
           detail::assign(n, p)(l, n);
         }
         else if (auto const r(detail::right_node(n, p));
-          cg0 && r && (node::cmp(mink, r->m_) < 0))
+          cg0 && r && (cmp_(mink, r->m_) < 0))
         {
           detail::assign(n, p)(r, n);
         }
@@ -973,17 +1532,17 @@ public:
 };
 
 //////////////////////////////////////////////////////////////////////////////
-template <int = 0, typename K, typename V, class C>
-inline auto erase(intervalmap<K, V, C>& c, auto&& k)
+template <int = 0, typename K, typename V, class C, class A, class P>
+inline auto erase(intervalmap<K, V, C, A, P>& c, auto&& k)
   noexcept(noexcept(c.erase(std::forward<decltype(k)>(k))))
   requires(
     detail::Comparable<
       C,
       decltype(std::get<0>(k)),
-      decltype(intervalmap<K, V, C>::node::m_)
+      decltype(intervalmap<K, V, C, A, P>::node::m_)
     > &&
     !std::same_as<
-      decltype(intervalmap<K, V, C>::node::m_),
+      decltype(intervalmap<K, V, C, A, P>::node::m_),
       std::remove_cvref_t<decltype(k)>
     >
   )
@@ -991,15 +1550,15 @@ inline auto erase(intervalmap<K, V, C>& c, auto&& k)
   return c.erase(std::forward<decltype(k)>(k));
 }
 
-template <typename K, typename V, class C>
-inline auto erase(intervalmap<K, V, C>& c, K const& k)
+template <typename K, typename V, class C, class A, class P>
+inline auto erase(intervalmap<K, V, C, A, P>& c, K const& k)
   noexcept(noexcept(erase<0>(c, k)))
 {
   return erase<0>(c, k);
 }
 
-template <typename K, typename V, class C>
-inline auto erase_if(intervalmap<K, V, C>& c, auto pred)
+template <typename K, typename V, class C, class A, class P>
+inline auto erase_if(intervalmap<K, V, C, A, P>& c, auto pred)
   noexcept(noexcept(pred(std::declval<K>()), c.erase(c.begin())))
 {
   typename std::remove_reference_t<decltype(c)>::size_type r{};
@@ -1010,8 +1569,11 @@ inline auto erase_if(intervalmap<K, V, C>& c, auto pred)
 }
 
 //////////////////////////////////////////////////////////////////////////////
-template <typename K, typename V, class C>
-inline void swap(intervalmap<K, V, C>& l, decltype(l) r) noexcept {l.swap(r);}
+template <typename K, typename V, class C, class A, class P>
+inline void swap(intervalmap<K, V, C, A, P>& l, decltype(l) r) noexcept
+{
+  l.swap(r);
+}
 
 }
 
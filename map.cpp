@@ -100,14 +100,14 @@ int main()
 
   while (S)
   {
-    st.erase(std::next(st.begin(), rand() % S--));
+    st.erase(st.nth(rand() % S--));
   }
 
   std::cout << std::chrono::nanoseconds(timer_t::now() - t0).count() << std::endl;
 
   xsg::map<std::string, std::unique_ptr<int>> ll;
   ll["lalala"] = std::make_unique<int>(11);
-  erase(ll, "lalala"); // bad
+  erase(ll, "lalala"); // good, looked up as a string_view
   erase(ll, "lalala"sv); // best
   erase(ll, {"lalala"}); // convenience
 
@@ -15,8 +15,10 @@ class mapiterator
   using iterator_t = mapiterator<std::remove_const_t<T>>;
   friend mapiterator<T const>;
 
+  using container_t = typename std::remove_const_t<T>::container;
+
   T* n_, *p_;
-  T* const* r_;
+  container_t const* c_; // the root and the comparator are found here
 
 public:
   using iterator_category = std::bidirectional_iterator_tag;
@@ -30,29 +32,30 @@ public:
   using pointer = value_type*;
   using reference = value_type&;
 
-  template <typename, typename, class> friend class map;
-  template <typename, class> friend class set;
+  template <typename, typename, class, class, class> friend class map;
+  template <typename, class, class, class> friend class set;
 
 public:
   mapiterator() = default;
 
-  mapiterator(T* const* const r) noexcept:
+  mapiterator(container_t const* const c) noexcept:
     n_(),
-    r_(r)
+    p_(),
+    c_(c)
   {
   }
 
-  mapiterator(T* const* const r, auto&& t) noexcept:
+  mapiterator(container_t const* const c, auto&& t) noexcept:
     n_(std::get<0>(t)),
     p_(std::get<1>(t)),
-    r_(r)
+    c_(c)
   {
   }
 
-  mapiterator(T* const* const r, T* const n, T* const p) noexcept:
+  mapiterator(container_t const* const c, T* const n, T* const p) noexcept:
     n_(n),
     p_(p),
-    r_(r)
+    c_(c)
   {
   }
 
@@ -62,7 +65,7 @@ public:
   mapiterator(iterator_t const& o) noexcept requires(std::is_const_v<T>):
     n_(o.n_),
     p_(o.p_),
-    r_(o.r_)
+    c_(o.c_)
   {
   }
 
@@ -73,7 +76,7 @@ public:
   mapiterator& operator=(iterator_t const& o) noexcept
     requires(std::is_const_v<T>)
   {
-    n_ = o.n_; p_ = o.p_; r_ = o.r_; return *this;
+    n_ = o.n_; p_ = o.p_; c_ = o.c_; return *this;
   }
 
   bool operator==(mapiterator const& o) const noexcept { return n_ == o.n_; }
@@ -81,14 +84,14 @@ public:
   // increment, decrement
   auto& operator++() noexcept
   {
-    std::tie(n_, p_) = detail::next_node(n_, p_); return *this;
+    std::tie(n_, p_) = detail::next_node(n_, p_, c_->cmp_); return *this;
   }
 
   auto& operator--() noexcept
   {
     std::tie(n_, p_) = n_ ?
-      detail::prev_node(n_, p_) :
-      detail::last_node(*r_, {});
+      detail::prev_node(n_, p_, c_->cmp_) :
+      detail::last_node(c_->root_, {});
 
     return *this;
   }
@@ -97,9 +100,9 @@ public:
   {
     auto const n(n_), p(p_);
 
-    std::tie(n_, p_) = detail::next_node(n_, p_);
+    std::tie(n_, p_) = detail::next_node(n_, p_, c_->cmp_);
 
-    return {r_, n, p};
+    return {c_, n, p};
   }
 
   mapiterator operator--(int) noexcept
@@ -107,10 +110,39 @@ public:
     auto const n(n_), p(p_);
 
     std::tie(n_, p_) = n_ ?
-      detail::prev_node(n_, p_) :
-      detail::last_node(*r_, {});
+      detail::prev_node(n_, p_, c_->cmp_) :
+      detail::last_node(c_->root_, {});
+
+    return {c_, n, p};
+  }
+
+  // jumps, O(log n) when the nodes cache their subtree sizes, std::next()
+  // and std::advance() do not use them, as the iterator is bidirectional
+  auto& operator+=(difference_type const d) noexcept
+  {
+    auto const r(c_->root_);
+
+    std::tie(n_, p_) = detail::nth(
+        r,
+        {},
+        d + (n_ ?
+          detail::rank(r, {}, n_->key(), c_->cmp_) :
+          detail::size(r, {}))
+      );
+
+    return *this;
+  }
 
-    return {r_, n, p};
+  auto& operator-=(difference_type const d) noexcept { return *this += -d; }
+
+  mapiterator operator+(difference_type const d) const noexcept
+  {
+    auto r(*this); return r += d;
+  }
+
+  mapiterator operator-(difference_type const d) const noexcept
+  {
+    auto r(*this); return r -= d;
   }
 
   // member access
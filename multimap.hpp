@@ -5,12 +5,15 @@
 #include "utils.hpp"
 
 #include "multimapiterator.hpp"
+#include "nodehandle.hpp"
 
 namespace xsg
 {
 
 template <typename Key, typename Value,
-  class Compare = std::compare_three_way>
+  class Compare = std::compare_three_way,
+  class Allocator = std::allocator<std::pair<Key const, Value>>,
+  class Policy = default_policy>
 class multimap
 {
 public:
@@ -19,6 +22,7 @@ public:
   using key_type = Key;
   using mapped_type = Value;
   using value_type = std::pair<Key const, Value>;
+  using allocator_type = Allocator;
 
   using difference_type = detail::difference_type;
   using size_type = detail::size_type;
@@ -30,13 +34,18 @@ public:
   using const_iterator = multimapiterator<node const>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
+  using node_type = nodehandle<node,
+    typename std::allocator_traits<Allocator>::template rebind_alloc<node>>;
+
   struct node
   {
     using value_type = multimap::value_type;
-
-    static constinit inline Compare const cmp;
+    using policy = Policy;
+    using container = multimap;
 
     std::uintptr_t l_, r_;
+    [[no_unique_address]] detail::node_prefix_t<Policy, Key> h_;
+    [[no_unique_address]] detail::node_size_t<Policy> s_;
     xl::list<value_type> v_;
 
     explicit node(auto&& k, auto&& ...a)
@@ -54,25 +63,32 @@ public:
         std::forward_as_tuple(std::forward<decltype(k)>(k)),
         std::forward_as_tuple(std::forward<decltype(a)>(a)...)
       );
+
+      if constexpr(detail::Prefixed<node>)
+      {
+        h_ = typename Policy::prefix()(key());
+      }
     }
 
     //
     auto& key() const noexcept { return std::get<0>(v_.front()); }
 
     //
-    static auto emplace(auto& r, auto&& k, auto&& ...a)
-      noexcept(noexcept(new node(std::forward<decltype(k)>(k),
+    static auto emplace(auto& al, auto& r, size_type& c, auto const& cmp,
+      auto&& k, auto&& ...a)
+      noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k),
         std::forward<decltype(a)>(a)...)))
       requires(detail::Comparable<Compare, decltype(k), key_type>)
     {
       auto const create_node([&](node* const p)
-        noexcept(noexcept(new node(std::forward<decltype(k)>(k),
+        noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k),
           std::forward<decltype(a)>(a)...)))
         {
-          auto const q(new node(std::forward<decltype(k)>(k),
+          auto const q(detail::new_node(al, std::forward<decltype(k)>(k),
             std::forward<decltype(a)>(a)...));
 
           q->l_ = q->r_ = detail::conv(p);
+          if constexpr(Policy::sized) q->s_ = 1;
 
           return q;
         }
@@ -80,7 +96,7 @@ public:
 
       if (r)
       {
-        auto const [q, qp, s](detail::emplace(r, k, create_node));
+        auto const [q, qp, s](detail::emplace(r, k, cmp, create_node, c));
 
         if (!s) q->v_.emplace_back(std::forward<decltype(k)>(k),
           std::forward<decltype(a)>(a)...);
@@ -89,198 +105,185 @@ public:
       }
       else
       {
-        return std::pair<node*, node*>(r = create_node({}), {});
+        r = create_node({}); c = 1;
+
+        return std::pair<node*, node*>(r, {});
       }
     }
 
-    static iterator erase(auto& r0, const_iterator const i)
-      noexcept(
-        noexcept(std::declval<node>().v_.erase(i.i())) &&
-        noexcept(node::erase(r0, i.n(), i.p()))
-      )
+    static auto emplace_hint(auto& al, auto& r, size_type& c, auto const& cmp,
+      node* const n, node* const p, auto&& k, auto&& ...a)
+      noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k),
+        std::forward<decltype(a)>(a)...)))
+      requires(detail::Comparable<Compare, decltype(k), key_type>)
     {
-      if (auto const n(i.n()), p(i.p()); 1 == n->v_.size())
-      {
-        auto const [nn, np, s](node::erase(r0, n, p));
+      auto const create_node([&](node* const p)
+        noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k),
+          std::forward<decltype(a)>(a)...)))
+        {
+          auto const q(detail::new_node(al, std::forward<decltype(k)>(k),
+            std::forward<decltype(a)>(a)...));
 
-        return {&r0, nn, np};
-      }
-      else if (auto const it(i.i()); std::next(it) == n->v_.end())
+          q->l_ = q->r_ = detail::conv(p);
+          if constexpr(Policy::sized) q->s_ = 1;
+
+          return q;
+        }
+      );
+
+      if (r)
       {
-        auto const ni(std::next(i));
+        auto const [q, qp, s](detail::emplace(r, n, p, k, cmp, create_node, c));
 
-        n->v_.erase(it);
+        if (!s) q->v_.emplace_back(std::forward<decltype(k)>(k),
+          std::forward<decltype(a)>(a)...);
 
-        return {&r0, ni.n(), ni.p()};
+        return std::pair(q, qp);
       }
       else
       {
-        return {&r0, n, p, n->v_.erase(it)};
+        r = create_node({}); c = 1;
+
+        return std::pair<node*, node*>(r, {});
       }
     }
 
-    static inline auto erase(auto& r0, auto const pp, decltype(pp) p,
-      decltype(pp) n, std::uintptr_t* const q)
-      noexcept(noexcept(delete r0))
+    static auto clone(auto& al, node const* const n)
     {
-      auto const s(n->v_.size()); // !!!
-      auto [nnn, nnp](detail::next_node(n, p));
-
-      // pp - p - n - lr
-      if (auto const l(detail::left_node(n, p)),
-        r(detail::right_node(n, p)); l && r)
-      {
-        if (detail::size(l, n) < detail::size(r, n)) // erase from right side?
-        {
-          auto const [fnn, fnp](detail::first_node(r, n));
-
-          if (fnn == nnn)
-          {
-            nnp = p;
-          }
-
-          if (q)
+      return detail::clone(
+          al,
+          n,
+          [&](auto const n)
           {
-            *q = detail::conv(fnn, pp);
-          }
-          else
-          {
-            r0 = fnn;
-          }
+            auto const m(
+              detail::new_node(
+                al,
+                std::get<0>(n->v_.front()),
+                std::get<1>(n->v_.front())
+              )
+            );
+            try
+            {
+              std::for_each(
+                std::next(n->v_.cbegin()),
+                n->v_.cend(),
+                [&](auto& v) { m->v_.emplace_back(v); }
+              );
+            }
+            catch (...)
+            {
+              detail::delete_node(al, m);
 
-          // convert and attach l to fnn
-          fnn->l_ = detail::conv(l, p); 
+              throw;
+            }
 
-          {
-            auto const nfnn(detail::conv(n, fnn));
-            l->l_ ^= nfnn; l->r_ ^= nfnn;
+            return m;
           }
+        );
+    }
 
-          if (r == fnn)
-          {
-            r->r_ ^= detail::conv(n, p);
-          }
-          else
+    static auto build(auto& al, auto const i, decltype(i) j, auto const& cmp,
+      size_type& c)
+    {
+      return detail::build(
+          al,
+          i,
+          j,
+          [&](auto&& v, node* const t) -> node*
           {
-            // attach right node of fnn to parent left
+            if (t && (cmp(std::get<0>(v), t->key()) == 0))
             {
-              auto const fnpp(detail::left_node(fnp, fnn));
-              auto const rn(detail::right_node(fnn, fnp));
-
-              fnp->l_ = detail::conv(rn, fnpp);
+              t->v_.emplace_back(std::forward<decltype(v)>(v));
 
-              if (rn)
-              {
-                auto const fnnfnp(detail::conv(fnn, fnp));
-                rn->l_ ^= fnnfnp; rn->r_ ^= fnnfnp;
-              }
+              return {};
             }
-
-            // convert and attach r to fnn
-            fnn->r_ = detail::conv(r, p);
-
+            else
             {
-              auto const nfnn(detail::conv(n, fnn));
-              r->l_ ^= nfnn; r->r_ ^= nfnn;
+              return detail::new_node(
+                  al,
+                  std::get<0>(std::forward<decltype(v)>(v)),
+                  std::get<1>(std::forward<decltype(v)>(v))
+                );
             }
-          }
-        }
-        else // erase from the left side
-        {
-          auto const [lnn, lnp](detail::last_node(l, n));
+          },
+          detail::fix_size,
+          c
+        );
+    }
 
-          if (r == nnn)
+    static void insert_batch(auto& al, auto& r, auto const i, decltype(i) j,
+      auto const& cmp)
+    {
+      detail::insert_batch(
+        al,
+        r,
+        i,
+        j,
+        cmp,
+        [](auto&& v) noexcept -> auto& { return std::get<0>(v); },
+        [&](auto&& v, node* const t) -> node*
+        {
+          if (t && (cmp(std::get<0>(v), t->key()) == 0))
           {
-            nnp = lnn;
-          }
+            t->v_.emplace_back(v);
 
-          if (q)
-          {
-            *q = detail::conv(lnn, pp);
+            return {};
           }
           else
           {
-            r0 = lnn;
-          }
-
-          // convert and attach r to lnn
-          lnn->r_ = detail::conv(r, p); 
-
-          {
-            auto const nlnn(detail::conv(n, lnn));
-            r->l_ ^= nlnn; r->r_ ^= nlnn;
+            return detail::new_node(al, std::get<0>(v), std::get<1>(v));
           }
+        },
+        detail::fix_size
+      );
+    }
 
-          if (l == lnn)
-          {
-            l->l_ ^= detail::conv(n, p);
-          }
-          else
-          {
-            {
-              auto const lnpp(detail::right_node(lnp, lnn));
-              auto const ln(detail::left_node(lnn, lnp));
-
-              lnp->r_ = detail::conv(ln, lnpp);
+    static iterator erase(container& c, const_iterator const i)
+      noexcept(
+        noexcept(std::declval<node>().v_.erase(i.i())) &&
+        noexcept(node::erase(c.alloc_, c.root_, i.n(), i.p(), c.cmp_))
+      )
+    {
+      if (auto const n(i.n()), p(i.p()); 1 == n->v_.size())
+      {
+        auto const [nn, np, s](node::erase(c.alloc_, c.root_, n, p, c.cmp_));
 
-              if (ln)
-              {
-                auto const lnnlnp(detail::conv(lnn, lnp));
-                ln->l_ ^= lnnlnp; ln->r_ ^= lnnlnp;
-              }
-            }
+        return {&c, nn, np};
+      }
+      else if (auto const it(i.i()); std::next(it) == n->v_.end())
+      {
+        auto const ni(std::next(i));
 
-            // convert and attach l to lnn
-            lnn->l_ = detail::conv(l, p);
+        n->v_.erase(it);
 
-            {
-              auto const nlnn(detail::conv(n, lnn));
-              l->l_ ^= nlnn; l->r_ ^= nlnn;
-            }
-          }
-        }
+        return {&c, ni.n(), ni.p()};
       }
       else
       {
-        auto const lr(l ? l : r);
-
-        if (lr)
-        {
-          if (lr == nnn)
-          {
-            nnp = p;
-          }
-
-          auto const np(detail::conv(n, p));
-          lr->l_ ^= np; lr->r_ ^= np;
-        }
-
-        if (q)
-        {
-          *q = detail::conv(lr, pp);
-        }
-        else
-        {
-          r0 = lr;
-        }
+        return {&c, n, p, n->v_.erase(it)};
       }
+    }
 
-      delete n;
+    static inline auto erase(auto& al, auto& r0, auto const pp,
+      decltype(pp) p, decltype(pp) n, std::uintptr_t* const q,
+      auto const& cmp) noexcept
+    {
+      auto const s(n->v_.size()); // !!!
+      auto const [nn, np](detail::erase(al, r0, pp, p, n, q, cmp));
 
-      return std::tuple(nnn, nnp, s);
+      return std::tuple(nn, np, s);
     }
 
-    static auto erase(auto& r0, auto&& k)
-      noexcept(noexcept(erase(r0, r0, r0, r0, {})))
+    static auto erase(auto& al, auto& r0, auto&& k, auto const& cmp)
+      noexcept(noexcept(erase(al, r0, r0, r0, r0, {}, cmp)))
     {
       using pointer = std::remove_cvref_t<decltype(r0)>;
-      using node = std::remove_pointer_t<pointer>;
 
       std::uintptr_t* q{};
 
       for (pointer pp{}, p{}, n(r0); n;)
       {
-        if (auto const c(node::cmp(k, n->key())); c < 0)
+        if (auto const c(cmp(k, n->key())); c < 0)
         {
           detail::assign(pp, p, n, q)(p, n, detail::left_node(n, p), &n->l_);
         }
@@ -290,67 +293,113 @@ public:
         }
         else
         {
-          return erase(r0, pp, p, n, q);
+          return erase(al, r0, pp, p, n, q, cmp);
         }
       }
 
       return std::tuple(pointer{}, pointer{}, decltype(r0->v_.size()){});
     }
 
-    static auto erase(auto& r0, auto const n, decltype(n) const p)
-      noexcept(noexcept(erase(r0, r0, r0, r0, {})))
+    static auto erase(auto& al, auto& r0, auto const n, decltype(n) const p,
+      auto const& cmp) noexcept(noexcept(erase(al, r0, r0, r0, r0, {}, cmp)))
     {
       using pointer = std::remove_cvref_t<decltype(r0)>;
-      using node = std::remove_pointer_t<pointer>;
 
       pointer pp{};
       std::uintptr_t* q{};
 
       if (p)
       {
-        node::cmp(n->key(), p->key()) < 0 ?
+        cmp(n->key(), p->key()) < 0 ?
           detail::assign(pp, q)(detail::left_node(p, n), &p->l_) :
           detail::assign(pp, q)(detail::right_node(p, n), &p->r_);
       }
 
-      return erase(r0, pp, p, n, q);
+      return erase(al, r0, pp, p, n, q, cmp);
     }
   };
 
 private:
   using this_class = multimap;
+  using node_allocator = typename std::allocator_traits<
+    Allocator>::template rebind_alloc<node>;
+
+  friend iterator;
+  friend const_iterator;
+
   node* root_{};
+  size_type n_{}; // the nodes in the tree, 0 if not known
+  size_type m_{}; // the most nodes since the last global rebuild
+  [[no_unique_address]] Compare cmp_;
+  [[no_unique_address]] node_allocator alloc_;
 
 public:
   multimap() = default;
 
+  explicit multimap(Compare const& c, Allocator const& a = Allocator())
+    noexcept(std::is_nothrow_copy_constructible_v<Compare>):
+    cmp_(c),
+    alloc_(a)
+  {
+  }
+
+  explicit multimap(Allocator const& a) noexcept: alloc_(a) { }
+
   multimap(multimap const& o)
-    noexcept(noexcept(*this = o))
-    requires(std::is_copy_constructible_v<value_type>)
+    requires(std::is_copy_constructible_v<value_type>):
+    cmp_(o.cmp_),
+    alloc_(std::allocator_traits<
+      node_allocator>::select_on_container_copy_construction(o.alloc_))
   {
-    *this = o;
+    root_ = node::clone(alloc_, o.root_); n_ = o.n_; m_ = o.m_;
   }
 
-  multimap(multimap&& o)
-    noexcept(noexcept(*this = std::move(o)))
+  multimap(multimap&& o) noexcept:
+    root_(std::exchange(o.root_, {})),
+    n_(std::exchange(o.n_, {})),
+    m_(std::exchange(o.m_, {})),
+    cmp_(o.cmp_),
+    alloc_(std::move(o.alloc_))
   {
-    *this = std::move(o);
   }
 
-  multimap(std::input_iterator auto const i, decltype(i) j)
+  multimap(std::input_iterator auto const i, decltype(i) j,
+    Compare const& c = Compare())
     noexcept(noexcept(insert(i, j)))
-    requires(std::is_constructible_v<value_type, decltype(*i)>)
+    requires(std::is_constructible_v<value_type, decltype(*i)>):
+    cmp_(c)
   {
+    if constexpr(std::forward_iterator<std::remove_const_t<decltype(i)>>)
+    {
+      if (j == std::adjacent_find(i, j, [this](auto&& a, auto&& b) noexcept
+        {
+          return cmp_(std::get<0>(a), std::get<0>(b)) > 0;
+        }))
+      {
+        root_ = node::build(alloc_, i, j, cmp_, n_);
+
+        return;
+      }
+    }
+
     insert(i, j);
   }
 
-  multimap(std::initializer_list<value_type> l)
+  multimap(sorted_equivalent_t, std::input_iterator auto const i, decltype(i) j,
+    Compare const& c = Compare())
+    requires(std::is_constructible_v<value_type, decltype(*i)>):
+    cmp_(c)
+  {
+    root_ = node::build(alloc_, i, j, cmp_, n_);
+  }
+
+  multimap(std::initializer_list<value_type> l, Compare const& c = Compare())
     noexcept(noexcept(multimap(l.begin(), l.end()))):
-    multimap(l.begin(), l.end())
+    multimap(l.begin(), l.end(), c)
   {
   }
 
-  ~multimap() noexcept(noexcept(delete root_)) { detail::destroy(root_, {}); }
+  ~multimap() noexcept { detail::destroy(alloc_, root_); }
 
 # include "common.hpp"
 
@@ -375,11 +424,11 @@ public:
   //
   template <int = 0>
   auto count(auto const& k) const noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
     for (decltype(root_) p{}, n(root_); n;)
     {
-      if (auto const c(node::cmp(k, n->key())); c < 0)
+      if (auto const c(cmp_(detail::key_view(k), n->key())); c < 0)
       {
         detail::assign(n, p)(detail::left_node(n, p), n);
       }
@@ -396,14 +445,17 @@ public:
     return decltype(root_->v_.size()){};
   }
 
-  auto count(key_type const k) const noexcept { return count<0>(k); }
+  auto count(key_type const& k) const noexcept { return count<0>(k); }
 
   //
   template <int = 0>
   iterator emplace(auto&& k, auto&& ...a)
     noexcept(noexcept(
         node::emplace(
+          alloc_,
           root_,
+          n_,
+          cmp_,
           std::forward<decltype(k)>(k),
           std::forward<decltype(a)>(a)...
         )
@@ -411,9 +463,12 @@ public:
     )
   {
     return {
-        &root_,
+        this,
         node::emplace(
+          alloc_,
           root_,
+          n_,
+          cmp_,
           std::forward<decltype(k)>(k),
           std::forward<decltype(a)>(a)...
         )
@@ -429,76 +484,354 @@ public:
     return emplace<0>(std::move(k), std::forward<decltype(a)>(a)...);
   }
 
+  template <int = 0>
+  iterator emplace_hint(const_iterator const h, auto&& k, auto&& ...a)
+    noexcept(noexcept(
+        node::emplace_hint(
+          alloc_,
+          root_,
+          n_,
+          cmp_,
+          {},
+          {},
+          std::forward<decltype(k)>(k),
+          std::forward<decltype(a)>(a)...
+        )
+      )
+    )
+  {
+    return {
+        this,
+        node::emplace_hint(
+          alloc_,
+          root_,
+          n_,
+          cmp_,
+          h.n(),
+          h.p(),
+          std::forward<decltype(k)>(k),
+          std::forward<decltype(a)>(a)...
+        )
+      };
+  }
+
+  auto emplace_hint(const_iterator const h, key_type k, auto&& ...a)
+    noexcept(noexcept(
+        emplace_hint<0>(h, std::move(k), std::forward<decltype(a)>(a)...)
+      )
+    )
+  {
+    return emplace_hint<0>(h, std::move(k), std::forward<decltype(a)>(a)...);
+  }
+
   //
   template <int = 0>
   auto equal_range(auto&& k) noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](detail::equal_range(root_, {}, k));
+    auto const [nl, g](
+      detail::equal_range(root_, {}, detail::key_view(k), cmp_));
 
-    return std::pair(iterator(&root_, nl), iterator(&root_, g));
+    return std::pair(iterator(this, nl), iterator(this, g));
   }
 
-  auto equal_range(key_type k) noexcept
+  auto equal_range(key_type const& k) noexcept
   {
-    return equal_range<0>(std::move(k));
+    return equal_range<0>(k);
   }
 
   template <int = 0>
   auto equal_range(auto&& k) const noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](detail::equal_range(root_, {}, k));
+    auto const [nl, g](
+      detail::equal_range(root_, {}, detail::key_view(k), cmp_));
 
-    return std::pair(const_iterator(&root_, nl), const_iterator(&root_, g));
+    return std::pair(const_iterator(this, nl), const_iterator(this, g));
   }
 
-  auto equal_range(key_type k) const noexcept
+  auto equal_range(key_type const& k) const noexcept
   {
-    return equal_range<0>(std::move(k));
+    return equal_range<0>(k);
   }
 
   //
   template <int = 0>
   auto erase(auto&& k)
-    noexcept(noexcept(node::erase(root_, k)))
-    requires(detail::Comparable<Compare, decltype(k), key_type> &&
+    noexcept(noexcept(node::erase(alloc_, root_, detail::key_view(k), cmp_)))
+    requires(detail::Lookup<Compare, decltype(k), key_type> &&
       !std::convertible_to<decltype(k), const_iterator>)
   {
-    return std::get<2>(node::erase(root_, k));
+    auto const s(std::get<2>(
+      node::erase(alloc_, root_, detail::key_view(k), cmp_)));
+
+    if (s && detail::erased<node>(n_, m_)) rebuild();
+
+    return s;
   }
 
-  auto erase(key_type k) noexcept(noexcept(erase<0>(std::move(k))))
+  auto erase(key_type const& k) noexcept(noexcept(erase<0>(k)))
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
-    return erase<0>(std::move(k));
+    return erase<0>(k);
   }
 
   iterator erase(const_iterator const i)
-    noexcept(noexcept(node::erase(root_, i)))
+    noexcept(noexcept(node::erase(*this, i)))
+  {
+    auto const s(1 == i.n()->v_.size());
+    iterator const j(node::erase(*this, i));
+
+    if (s && detail::erased<node>(n_, m_))
+    { // the parent of the next node changes
+      rebuild();
+
+      if (auto const n(j.n()); n)
+      {
+        return {this, detail::find(root_, {}, n->key(), cmp_)};
+      }
+    }
+
+    return j;
+  }
+
+  iterator erase(const_iterator const a, const_iterator const b) noexcept
+  { // partial groups at the ends go element by element, the whole groups
+    // in between are cut out as one subtree
+    auto const n(a.n()), m(b.n());
+
+    if (a == b)
+    {
+      return n ?
+        iterator(
+          this,
+          n,
+          a.p(),
+          std::next(n->v_.begin(), std::distance(n->v_.cbegin(), a.i()))
+        ) :
+        end();
+    }
+    else if (n == m)
+    {
+      auto i(n->v_.erase(a.i()));
+      for (; &*i != &*b.i(); i = n->v_.erase(i));
+
+      return {this, n, a.p(), i};
+    }
+
+    auto l(n); // the first node of the cut
+
+    if (n->v_.cbegin() != a.i())
+    {
+      for (auto i(a.i()); n->v_.cend() != i; i = n->v_.erase(i));
+
+      l = std::get<0>(detail::next_node(n, a.p(), cmp_));
+    }
+
+    if (m)
+    {
+      auto i(m->v_.begin());
+      for (; &*i != &*b.i(); i = m->v_.erase(i));
+
+      auto const& k(m->key());
+
+      if (l != m) detail::erase_range(alloc_, root_, l->key(), &k, cmp_);
+      n_ = detail::node_count(root_); m_ = {};
+
+      auto const [q, qp](detail::find(root_, {}, k, cmp_));
+
+      return {this, q, qp, i};
+    }
+    else
+    {
+      if (l)
+      {
+        detail::erase_range(alloc_, root_, l->key(), decltype(&n->key()){},
+          cmp_);
+      }
+
+      n_ = detail::node_count(root_); m_ = {};
+
+      return end();
+    }
+  }
+
+  //
+  node_type extract(const_iterator const i) noexcept
+  {
+    auto const n(i.n());
+    detail::unlink(root_, n, i.p(), cmp_);
+    if (detail::erased<node>(n_, m_)) rebuild();
+
+    return {n, alloc_};
+  }
+
+  template <int = 0>
+  node_type extract(auto const& k) noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type> &&
+      !std::convertible_to<decltype(k), const_iterator>)
+  {
+    auto const [n, p](detail::find(root_, {}, detail::key_view(k), cmp_));
+
+    return n ? extract(const_iterator(this, n, p)) : node_type();
+  }
+
+  auto extract(key_type const& k) noexcept { return extract<0>(k); }
+
+  // an existing group of equivalent keys takes over the elements, unmoved
+  iterator insert(node_type&& nh) noexcept
+  {
+    if (nh)
+    {
+      auto const n(nh.n_);
+      auto const [q, qp, s](detail::insert(root_, n_, n, cmp_));
+
+      if (s)
+      {
+        nh.release();
+      }
+      else
+      {
+        q->v_.splice(q->v_.end(), n->v_);
+
+        nh = {};
+      }
+
+      return {this, q, qp};
+    }
+    else
+    {
+      return end();
+    }
+  }
+
+  // groups of equivalent keys are joined, splicing the elements over
+  void merge(this_class& o) noexcept
+  {
+    detail::merge(
+      root_,
+      o.root_,
+      n_,
+      cmp_,
+      detail::fix_size,
+      [this](auto& r, auto& c, auto const n) noexcept
+      {
+        return detail::insert(r, c, n, cmp_);
+      },
+      [&](auto const q, auto const n) noexcept
+      {
+        q->v_.splice(q->v_.end(), n->v_);
+
+        detail::delete_node(alloc_, n);
+
+        return true;
+      }
+    );
+
+    o.n_ = detail::node_count(o.root_); m_ = o.m_ = {};
+  }
+
+  void merge(this_class&& o) noexcept { merge(o); }
+
+  // the keys not less than k move into the returned container
+  template <int = 0>
+  this_class split(auto const& k) noexcept
+    requires(detail::Comparable<Compare, decltype(k), key_type>)
+  {
+    this_class r(cmp_, alloc_);
+    r.root_ = detail::split(root_, k, cmp_);
+    r.n_ = detail::node_count(r.root_);
+    n_ = detail::node_count(root_); m_ = {};
+
+    return r;
+  }
+
+  auto split(key_type const k) noexcept { return split<0>(k); }
+
+  // the keys of o have to be all less or all greater than the ones here
+  void join(this_class& o) noexcept
+  {
+    detail::join(root_, o.root_, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  void join(this_class&& o) noexcept { join(o); }
+
+  // rebalance the whole tree, see default_policy::deferred
+  void rebuild() noexcept { detail::rebuild(root_); m_ = n_; }
+
+  // rebalance scapegoats for at most about budget steps, returns the rest,
+  // a global rebuild due after erasures goes first, if the budget covers it
+  size_type maybe_rebalance(size_type const budget) noexcept
+    requires(Policy::sized)
+  {
+    if (detail::shrunk<node>(n_, m_) && (n_ <= budget))
+    {
+      rebuild();
+
+      return budget - n_;
+    }
+
+    return detail::maybe_rebalance(root_, budget, cmp_);
+  }
+
+  // the keys in [lo, hi) are erased
+  template <int = 0>
+  void erase_range(auto const& lo, auto const& hi) noexcept
+    requires(detail::Comparable<Compare, decltype(lo), key_type> &&
+      detail::Comparable<Compare, decltype(hi), key_type>)
+  {
+    detail::erase_range(alloc_, root_, lo, &hi, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  void erase_range(key_type const lo, key_type const hi) noexcept
   {
-    return node::erase(root_, i);
+    erase_range<0>(lo, hi);
   }
 
   //
   iterator insert(value_type const& v)
-    noexcept(noexcept(node::emplace(root_, std::get<0>(v), std::get<1>(v))))
+    noexcept(noexcept(
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v), std::get<1>(v))
+      )
+    )
   {
-    return {&root_, node::emplace(root_, std::get<0>(v), std::get<1>(v))};
+    return {
+        this,
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v), std::get<1>(v))
+      };
   }
 
   iterator insert(value_type&& v)
     noexcept(noexcept(
-        node::emplace(root_, std::get<0>(v), std::move(std::get<1>(v)))
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v),
+          std::move(std::get<1>(v)))
       )
     )
   {
     return {
-        &root_,
-        node::emplace(root_, std::get<0>(v), std::move(std::get<1>(v)))
+        this,
+        node::emplace(alloc_, root_, n_, cmp_, std::get<0>(v),
+          std::move(std::get<1>(v)))
       };
   }
 
+  iterator insert(const_iterator const h, value_type const& v)
+    noexcept(noexcept(emplace_hint(h, std::get<0>(v), std::get<1>(v))))
+  {
+    return emplace_hint(h, std::get<0>(v), std::get<1>(v));
+  }
+
+  iterator insert(const_iterator const h, value_type&& v)
+    noexcept(noexcept(
+        emplace_hint(h, std::get<0>(v), std::move(std::get<1>(v)))
+      )
+    )
+  {
+    return emplace_hint(h, std::get<0>(v), std::move(std::get<1>(v)));
+  }
+
   void insert(std::input_iterator auto const i, decltype(i) j)
     noexcept(noexcept(emplace(std::get<0>(*i), std::get<1>(*i))))
   {
@@ -521,34 +854,72 @@ public:
       }
     );
   }
+
+  // a sorted range goes in with a single walk, see detail::insert_batch()
+  void insert_batch(std::forward_iterator auto const i, decltype(i) j)
+  {
+    node::insert_batch(alloc_, root_, i, j, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  // the keys in a sorted range are erased with a single walk
+  size_type erase_batch(std::forward_iterator auto const i, decltype(i) j)
+    noexcept
+  {
+    auto const c(
+      detail::erase_batch(
+        root_,
+        i,
+        j,
+        cmp_,
+        [](auto&& k) noexcept -> auto& { return k; },
+        detail::fix_size,
+        [this](auto& r, auto const n, auto const p) noexcept
+        {
+          detail::unlink(r, n, p, cmp_);
+        },
+        [&](auto const n) noexcept
+        {
+          size_type const s(n->v_.size());
+          detail::delete_node(alloc_, n);
+
+          return s;
+        }
+      )
+    );
+
+    n_ = detail::node_count(root_); m_ = {};
+
+    return c;
+  }
 };
 
 //////////////////////////////////////////////////////////////////////////////
-template <int = 0, typename K, typename V, class C>
-inline auto erase(multimap<K, V, C>& c, auto const& k)
+template <int = 0, typename K, typename V, class C, class A, class P>
+inline auto erase(multimap<K, V, C, A, P>& c, auto const& k)
   noexcept(noexcept(c.erase(K(k))))
-  requires(!detail::Comparable<C, decltype(k), K>)
+  requires(!detail::Lookup<C, decltype(k), K>)
 {
   return c.erase(K(k));
 }
 
-template <int = 0, typename K, typename V, class C>
-inline auto erase(multimap<K, V, C>& c, auto const& k)
+template <int = 0, typename K, typename V, class C, class A, class P>
+inline auto erase(multimap<K, V, C, A, P>& c, auto const& k)
   noexcept(noexcept(c.erase(k)))
-  requires(detail::Comparable<C, decltype(k), K>)
+  requires(detail::Lookup<C, decltype(k), K>)
 {
   return c.erase(k);
 }
 
-template <typename K, typename V, class C>
-inline auto erase(multimap<K, V, C>& c, K const k)
+template <typename K, typename V, class C, class A, class P>
+inline auto erase(multimap<K, V, C, A, P>& c, K const& k)
   noexcept(noexcept(erase<0>(c, k)))
 {
   return erase<0>(c, k);
 }
 
-template <typename K, typename V, class C>
-inline auto erase_if(multimap<K, V, C>& c, auto pred)
+template <typename K, typename V, class C, class A, class P>
+inline auto erase_if(multimap<K, V, C, A, P>& c, auto pred)
   noexcept(noexcept(pred(std::declval<K>()), c.erase(c.begin())))
 {
   typename std::remove_reference_t<decltype(c)>::size_type r{};
@@ -559,8 +930,11 @@ inline auto erase_if(multimap<K, V, C>& c, auto pred)
 }
 
 //////////////////////////////////////////////////////////////////////////////
-template <typename K, typename V, class C>
-inline void swap(multimap<K, V, C>& l, decltype(l) r) noexcept { l.swap(r); }
+template <typename K, typename V, class C, class A, class P>
+inline void swap(multimap<K, V, C, A, P>& l, decltype(l) r) noexcept
+{
+  l.swap(r);
+}
 
 }
 
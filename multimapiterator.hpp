@@ -21,6 +21,7 @@ class multimapiterator
   friend inverse_const_t;
 
   using node_t = std::remove_const_t<T>;
+  using container_t = typename node_t::container;
 
 public:
   using iterator_category = std::bidirectional_iterator_tag;
@@ -41,22 +42,23 @@ private:
     typename xl::list<std::remove_const_t<value_type>>::const_iterator,
     typename xl::list<std::remove_const_t<value_type>>::iterator
   > i_;
-  node_t* const* r_;
+  container_t const* c_; // the root and the comparator are found here
 
 public:
   multimapiterator() = default;
 
-  multimapiterator(decltype(r_) const r) noexcept:
+  multimapiterator(decltype(c_) const c) noexcept:
     n_(),
+    p_(),
     i_(),
-    r_(r)
+    c_(c)
   {
   }
 
-  multimapiterator(decltype(r_) const r, auto&& t) noexcept:
+  multimapiterator(decltype(c_) const c, auto&& t) noexcept:
     n_(std::get<0>(t)),
     p_(std::get<1>(t)),
-    r_(r)
+    c_(c)
   {
     if (n_)
     {
@@ -71,11 +73,11 @@ public:
     }
   }
 
-  multimapiterator(decltype(r_) const r, decltype(n_) const n,
+  multimapiterator(decltype(c_) const c, decltype(n_) const n,
     decltype(n) const p) noexcept:
     n_(n),
     p_(p),
-    r_(r)
+    c_(c)
   {
     if (n)
     {
@@ -90,12 +92,12 @@ public:
     }
   }
 
-  multimapiterator(decltype(r_) const r, decltype(n_) const n,
+  multimapiterator(decltype(c_) const c, decltype(n_) const n,
     decltype(n) p, decltype(i_) const i) noexcept:
     n_(n),
     p_(p),
     i_(i),
-    r_(r)
+    c_(c)
   {
   }
 
@@ -107,7 +109,7 @@ public:
     n_(o.n_),
     p_(o.p_),
     i_(o.i_),
-    r_(o.r_)
+    c_(o.c_)
   {
   }
 
@@ -125,7 +127,7 @@ public:
   {
     if (i_ = std::next(i_); n_->v_.end() == i_)
     {
-      if (std::tie(n_, p_) = detail::next_node(n_, p_); n_)
+      if (std::tie(n_, p_) = detail::next_node(n_, p_, c_->cmp_); n_)
       {
         i_ = n_->v_.begin();
       }
@@ -138,14 +140,14 @@ public:
   {
     if (!n_)
     {
-      if (std::tie(n_, p_) = detail::last_node(*r_, {}); n_)
+      if (std::tie(n_, p_) = detail::last_node(c_->root_, {}); n_)
       {
         i_ = std::prev(n_->v_.end());
       }
     }
     else if (n_->v_.begin() == i_)
     {
-      if (std::tie(n_, p_) = detail::prev_node(n_, p_); n_)
+      if (std::tie(n_, p_) = detail::prev_node(n_, p_, c_->cmp_); n_)
       {
         i_ = std::prev(n_->v_.end());
       }
@@ -161,6 +163,67 @@ public:
   auto operator++(int) noexcept { auto const r(*this); ++*this; return r; }
   auto operator--(int) noexcept { auto const r(*this); --*this; return r; }
 
+  // jumps, whole key groups are hopped over instead of stepped through, one
+  // group at a time, as the nodes do not count the elements of their subtrees
+  auto& operator+=(difference_type d) noexcept
+  {
+    if (d > 0)
+    {
+      for (; d && (n_->v_.end() != std::next(i_)); --d, ++i_);
+
+      if (d)
+      { // i_ is the last element of its group
+        auto const& cmp(c_->cmp_);
+
+        for (std::tie(n_, p_) = detail::next_node(n_, p_, cmp), --d;
+          n_ && (d >= difference_type(n_->v_.size()));
+          d -= n_->v_.size(),
+          std::tie(n_, p_) = detail::next_node(n_, p_, cmp));
+
+        if (n_)
+        {
+          for (i_ = n_->v_.begin(); d; --d, ++i_);
+        }
+        else
+        {
+          i_ = {};
+        }
+      }
+    }
+    else if (d < 0)
+    {
+      if (!n_) { --*this; ++d; }
+
+      for (; d && (n_->v_.begin() != i_); ++d, --i_);
+
+      if (d)
+      { // i_ is the first element of its group
+        auto const& cmp(c_->cmp_);
+
+        for (std::tie(n_, p_) = detail::prev_node(n_, p_, cmp), ++d;
+          -d >= difference_type(n_->v_.size());
+          d += n_->v_.size(),
+          std::tie(n_, p_) = detail::prev_node(n_, p_, cmp));
+
+        for (i_ = std::prev(n_->v_.end()); d; ++d, --i_);
+      }
+    }
+
+    return *this;
+  }
+
+  auto& operator-=(difference_type const d) noexcept { return *this += -d; }
+
+  multimapiterator operator+(difference_type const d) const noexcept
+  {
+    auto r(*this); return r += d;
+  }
+
+  multimapiterator operator-(difference_type const d) const noexcept
+  {
+    auto r(*this); return r -= d;
+  }
+
   // member access
   auto& operator->() const noexcept { return i_; }
   auto& operator*() const noexcept { return *i_; }
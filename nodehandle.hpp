@@ -0,0 +1,94 @@
+#ifndef XSG_NODEHANDLE_HPP
+# define XSG_NODEHANDLE_HPP
+# pragma once
+
+#include <memory>
+#include <utility>
+
+namespace xsg
+{
+
+// Owns a node extracted from a container, until it is inserted into another
+// one. Both containers have to use allocators that compare equal.
+template <typename Node, class Allocator>
+class nodehandle
+{
+  template <typename, typename, class, class, class> friend class map;
+  template <typename, class, class, class> friend class set;
+  template <typename, typename, class, class, class> friend class multimap;
+  template <typename, class, class, class> friend class multiset;
+  template <typename, typename, class, class, class> friend class intervalmap;
+
+  Node* n_{};
+  [[no_unique_address]] Allocator al_;
+
+  nodehandle(Node* const n, Allocator const& al) noexcept: n_(n), al_(al) { }
+
+  auto release() noexcept { return std::exchange(n_, {}); }
+
+public:
+  using allocator_type = Allocator;
+
+public:
+  nodehandle() = default;
+
+  nodehandle(nodehandle&& o) noexcept:
+    n_(std::exchange(o.n_, {})),
+    al_(std::move(o.al_))
+  {
+  }
+
+  ~nodehandle() noexcept { if (n_) detail::delete_node(al_, n_); }
+
+  //
+  nodehandle& operator=(nodehandle&& o) noexcept
+  {
+    if (this != &o)
+    {
+      if (n_) detail::delete_node(al_, n_);
+
+      n_ = std::exchange(o.n_, {});
+      al_ = std::move(o.al_);
+    }
+
+    return *this;
+  }
+
+  //
+  explicit operator bool() const noexcept { return n_; }
+  bool empty() const noexcept { return !n_; }
+
+  auto get_allocator() const noexcept { return al_; }
+
+  //
+  auto& key() const noexcept { return n_->key(); }
+
+  auto& mapped() const noexcept requires(requires { std::get<1>(n_->kv_); })
+  {
+    return std::get<1>(n_->kv_);
+  }
+
+  auto& value() const noexcept requires(requires { n_->kv_; })
+  {
+    return n_->kv_;
+  }
+
+  // multi containers move whole groups of equivalent keys
+  auto& values() const noexcept requires(requires { n_->v_; })
+  {
+    return n_->v_;
+  }
+
+  //
+  void swap(nodehandle& o) noexcept
+  {
+    std::swap(n_, o.n_);
+    std::swap(al_, o.al_);
+  }
+
+  friend void swap(nodehandle& l, nodehandle& r) noexcept { l.swap(r); }
+};
+
+}
+
+#endif // XSG_NODEHANDLE_HPP
@@ -0,0 +1,71 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "set.hpp"
+
+// lookup cost with and without prefetching, for trees up to well past the
+// size of the last level cache
+struct policy: xsg::default_policy
+{
+  static constexpr bool prefetch{true};
+};
+
+//////////////////////////////////////////////////////////////////////////////
+double bench(auto const& s, std::vector<unsigned long> const& probes)
+{
+  using timer_t = std::chrono::high_resolution_clock;
+
+  auto const t0(timer_t::now());
+
+  std::size_t c{};
+  for (auto const k: probes) c += s.contains(k);
+
+  auto const t(std::chrono::duration<double>(timer_t::now() - t0).count());
+
+  return t * 1e9 / (c ? probes.size() : 1);
+}
+
+void bench(std::vector<unsigned long> const& keys,
+  std::vector<unsigned long> const& probes)
+{
+  xsg::set<unsigned long> a;
+  xsg::set<unsigned long, std::compare_three_way,
+    std::allocator<unsigned long>, policy> b;
+
+  // interleaved, so that both trees get alike memory layouts
+  for (auto const k: keys) { a.insert(k); b.insert(k); }
+
+  std::cout << keys.size() << " keys (" <<
+    (keys.size() * sizeof(*a.root()) >> 20) << " MiB of nodes)";
+
+  for (int i{}; i != 2; ++i)
+  {
+    std::cout << ", find " << bench(a, probes) << " ns" <<
+      ", prefetching " << bench(b, probes) << " ns";
+  }
+
+  std::cout << std::endl;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+int main()
+{
+  std::mt19937_64 g(1);
+
+  std::vector<unsigned long> probes(1 << 22);
+
+  for (std::size_t n{1 << 12}; n <= 1 << 24; n <<= 2)
+  {
+    std::vector<unsigned long> keys(n);
+    for (auto& k: keys) k = g();
+
+    // half of the probes are hits
+    for (auto& k: probes) k = g() % 2 ? keys[g() % n] : g();
+
+    bench(keys, probes);
+  }
+
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include <cassert>
 #include <iostream>
 
 #include "xl/list.hpp"
@@ -66,6 +67,10 @@ int main()
   s.erase(std::next(s.cbegin()));
   s.erase(std::prev(s.cend()));
 
+  assert(s.erase(3) == 1); // the largest key, no successor
+  assert(s.erase(3) == 0);
+  s.insert(3);
+
   dump(s.root(), {});
 
   std::for_each(
@@ -4,12 +4,16 @@
 
 #include "utils.hpp"
 
+#include "frozen.hpp"
 #include "mapiterator.hpp"
+#include "nodehandle.hpp"
 
 namespace xsg
 {
 
-template <typename Key, class Compare = std::compare_three_way>
+template <typename Key, class Compare = std::compare_three_way,
+  class Allocator = std::allocator<Key>,
+  class Policy = default_policy>
 class set
 {
 public:
@@ -17,6 +21,7 @@ public:
 
   using key_type = Key;
   using value_type = Key;
+  using allocator_type = Allocator;
 
   using difference_type = detail::difference_type;
   using size_type = detail::size_type;
@@ -28,88 +33,228 @@ public:
   using const_iterator = mapiterator<node const>;
   using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
+  using node_type = nodehandle<node,
+    typename std::allocator_traits<Allocator>::template rebind_alloc<node>>;
+
+  struct insert_return_type
+  {
+    iterator position;
+    bool inserted;
+    node_type node;
+  };
+
   struct node
   {
     using value_type = set::value_type;
-
-    static constinit inline Compare const cmp;
+    using policy = Policy;
+    using container = set;
 
     std::uintptr_t l_, r_;
+    [[no_unique_address]] detail::node_prefix_t<Policy, Key> h_;
+    [[no_unique_address]] detail::node_size_t<Policy> s_;
     Key const kv_;
 
     explicit node(auto&& ...a)
       noexcept(noexcept(Key(std::forward<decltype(a)>(a)...))):
       kv_(std::forward<decltype(a)>(a)...)
     {
+      if constexpr(detail::Prefixed<node>)
+      {
+        h_ = typename Policy::prefix()(kv_);
+      }
     }
 
     //
     auto& key() const noexcept { return kv_; }
 
     //
-    static auto emplace(auto& r, auto&& k)
-      noexcept(noexcept(new node(std::forward<decltype(k)>(k))))
+    static auto emplace(auto& al, auto& r, size_type& c, auto const& cmp,
+      auto&& k)
+      noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k))))
+      requires(detail::Comparable<Compare, decltype(k), key_type>)
+    {
+      auto const create_node([&](node* const p)
+        noexcept(noexcept(detail::new_node(al,
+          std::forward<decltype(k)>(k))))
+        {
+          auto const q(detail::new_node(al, std::forward<decltype(k)>(k)));
+          q->l_ = q->r_ = detail::conv(p);
+          if constexpr(Policy::sized) q->s_ = 1;
+
+          return q;
+        }
+      );
+
+      return r ? detail::emplace(r, k, cmp, create_node, c) :
+        std::tuple<node*, node*, bool>(r = create_node({}), {}, (c = 1, true));
+    }
+
+    static auto emplace_hint(auto& al, auto& r, size_type& c, auto const& cmp,
+      node* const n, node* const p, auto&& k)
+      noexcept(noexcept(detail::new_node(al, std::forward<decltype(k)>(k))))
       requires(detail::Comparable<Compare, decltype(k), key_type>)
     {
       auto const create_node([&](node* const p)
-        noexcept(noexcept(new node(std::forward<decltype(k)>(k))))
+        noexcept(noexcept(detail::new_node(al,
+          std::forward<decltype(k)>(k))))
         {
-          auto const q(new node(std::forward<decltype(k)>(k)));
+          auto const q(detail::new_node(al, std::forward<decltype(k)>(k)));
           q->l_ = q->r_ = detail::conv(p);
+          if constexpr(Policy::sized) q->s_ = 1;
 
           return q;
         }
       );
 
-      return r ? detail::emplace(r, k, create_node) :
-        std::tuple<node*, node*, bool>(r = create_node({}), {}, true);
+      return r ? detail::emplace(r, n, p, k, cmp, create_node, c) :
+        std::tuple<node*, node*, bool>(r = create_node({}), {}, (c = 1, true));
+    }
+
+    static auto clone(auto& al, node const* const n)
+    {
+      return detail::clone(
+          al,
+          n,
+          [&](auto const n) { return detail::new_node(al, n->kv_); }
+        );
     }
 
-    static auto emplace(auto& r, auto&& ...a)
+    static auto build(auto& al, auto const i, decltype(i) j, size_type& c)
+    {
+      return detail::build(
+          al,
+          i,
+          j,
+          [&](auto&& v, node*)
+          {
+            return detail::new_node(al, std::forward<decltype(v)>(v));
+          },
+          detail::fix_size,
+          c
+        );
+    }
+
+    static void insert_batch(auto& al, auto& r, auto const i, decltype(i) j,
+      auto const& cmp)
+    {
+      detail::insert_batch(
+        al,
+        r,
+        i,
+        j,
+        cmp,
+        [](auto&& v) noexcept -> auto& { return v; },
+        [&](auto&& v, node* const t) -> node*
+        { // the first of the equivalent keys stays
+          return t && (cmp(v, t->key()) == 0) ? nullptr :
+            detail::new_node(al, v);
+        },
+        detail::fix_size
+      );
+    }
+
+    static auto emplace(auto& al, auto& r, size_type& c, auto const& cmp,
+      auto&& ...a)
       noexcept(noexcept(
-          emplace(r, key_type(std::forward<decltype(a)>(a)...))))
+          emplace(al, r, c, cmp, key_type(std::forward<decltype(a)>(a)...))))
+      requires(std::is_constructible_v<key_type, decltype(a)...>)
+    {
+      return emplace(al, r, c, cmp,
+        key_type(std::forward<decltype(a)>(a)...));
+    }
+
+    static auto emplace_hint(auto& al, auto& r, size_type& c, auto const& cmp,
+      node* const n, node* const p, auto&& ...a)
+      noexcept(noexcept(emplace_hint(al, r, c, cmp, n, p,
+        key_type(std::forward<decltype(a)>(a)...))))
       requires(std::is_constructible_v<key_type, decltype(a)...>)
     {
-      return emplace(r, key_type(std::forward<decltype(a)>(a)...));
+      return emplace_hint(al, r, c, cmp, n, p,
+        key_type(std::forward<decltype(a)>(a)...));
     }
   };
 
 private:
   using this_class = set;
+  using node_allocator = typename std::allocator_traits<
+    Allocator>::template rebind_alloc<node>;
+
+  friend iterator;
+  friend const_iterator;
+
   node* root_{};
+  size_type n_{}; // the nodes in the tree, 0 if not known
+  size_type m_{}; // the most nodes since the last global rebuild
+  [[no_unique_address]] Compare cmp_;
+  [[no_unique_address]] node_allocator alloc_;
 
 public:
   set() = default;
 
-  set(set const& o) 
-    noexcept(noexcept(set(o.begin(), o.end())))
+  explicit set(Compare const& c, Allocator const& a = Allocator())
+    noexcept(std::is_nothrow_copy_constructible_v<Compare>):
+    cmp_(c),
+    alloc_(a)
+  {
+  }
+
+  explicit set(Allocator const& a) noexcept: alloc_(a) { }
+
+  set(set const& o)
     requires(std::is_copy_constructible_v<value_type>):
-    set(o.begin(), o.end())
+    cmp_(o.cmp_),
+    alloc_(std::allocator_traits<
+      node_allocator>::select_on_container_copy_construction(o.alloc_))
   {
-    *this = o;
+    root_ = node::clone(alloc_, o.root_); n_ = o.n_; m_ = o.m_;
   }
 
-  set(set&& o)
-    noexcept(noexcept(*this = std::move(o)))
+  set(set&& o) noexcept:
+    root_(std::exchange(o.root_, {})),
+    n_(std::exchange(o.n_, {})),
+    m_(std::exchange(o.m_, {})),
+    cmp_(o.cmp_),
+    alloc_(std::move(o.alloc_))
   {
-    *this = std::move(o);
   }
 
-  set(std::input_iterator auto const i, decltype(i) j)
-    noexcept(noexcept(insert(i, j)))
+  set(std::input_iterator auto const i, decltype(i) j,
+    Compare const& c = Compare())
+    noexcept(noexcept(insert(i, j))):
+    cmp_(c)
   {
+    if constexpr(std::forward_iterator<std::remove_const_t<decltype(i)>>)
+    {
+      if (j == std::adjacent_find(i, j, [this](auto&& a, auto&& b) noexcept
+        {
+          return cmp_(a, b) >= 0;
+        }))
+      {
+        root_ = node::build(alloc_, i, j, n_);
+
+        return;
+      }
+    }
+
     insert(i, j);
   }
 
-  set(std::initializer_list<value_type> l)
+  set(sorted_unique_t, std::input_iterator auto const i, decltype(i) j,
+    Compare const& c = Compare()):
+    cmp_(c)
+  {
+    root_ = node::build(alloc_, i, j, n_);
+  }
+
+  set(std::initializer_list<value_type> l, Compare const& c = Compare())
     noexcept(noexcept(set(l.begin(), l.end()))):
-    set(l.begin(), l.end())
+    set(l.begin(), l.end(), c)
   {
   }
 
-  ~set() noexcept(noexcept(detail::destroy(root_, {})))
+  ~set() noexcept(noexcept(detail::destroy(alloc_, root_)))
   {
-    detail::destroy(root_, {});
+    detail::destroy(alloc_, root_);
   }
 
 # include "common.hpp"
@@ -117,49 +262,108 @@ public:
   //
   auto size() const noexcept { return detail::size(root_, {}); }
 
+  // order statistics, O(log n) when the nodes cache their subtree sizes
+  iterator nth(size_type const k) noexcept
+  {
+    return {this, detail::nth(root_, {}, k)};
+  }
+
+  const_iterator nth(size_type const k) const noexcept
+  {
+    return {this, detail::nth(root_, {}, k)};
+  }
+
+  template <int = 0>
+  size_type rank(auto const& k) const noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
+  {
+    return detail::rank(root_, {}, detail::key_view(k), cmp_);
+  }
+
+  auto rank(key_type const& k) const noexcept { return rank<0>(k); }
+
+  size_type index_of(const_iterator const i) const noexcept
+  {
+    return i.n_ ? detail::rank(root_, {}, i.n_->key(), cmp_) : size();
+  }
+
   //
   template <int = 0>
   size_type count(auto const& k) const noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
-    return bool(detail::find(root_, {}, k));
+    return bool(
+      std::get<0>(detail::find(root_, {}, detail::key_view(k), cmp_)));
   }
 
-  auto count(key_type const k) const noexcept { return count<0>(k); }
+  auto count(key_type const& k) const noexcept { return count<0>(k); }
 
   //
   auto emplace(auto&& ...a)
-    noexcept(noexcept(node::emplace(root_, std::forward<decltype(a)>(a)...)))
+    noexcept(noexcept(
+        node::emplace(alloc_, root_, n_, cmp_, std::forward<decltype(a)>(a)...)
+      )
+    )
   {
     auto const [n, p, s](
-      node::emplace(root_, std::forward<decltype(a)>(a)...)
+      node::emplace(alloc_, root_, n_, cmp_, std::forward<decltype(a)>(a)...)
     );
 
-    return std::pair(iterator(&root_, n, p), s);
+    return std::pair(iterator(this, n, p), s);
+  }
+
+  iterator emplace_hint(const_iterator const h, auto&& ...a)
+    noexcept(noexcept(
+        node::emplace_hint(
+          alloc_,
+          root_,
+          n_,
+          cmp_,
+          {},
+          {},
+          std::forward<decltype(a)>(a)...
+        )
+      )
+    )
+  {
+    return {
+        this,
+        node::emplace_hint(
+          alloc_,
+          root_,
+          n_,
+          cmp_,
+          const_cast<node*>(h.n_),
+          const_cast<node*>(h.p_),
+          std::forward<decltype(a)>(a)...
+        )
+      };
   }
 
   //
   template <int = 0>
   auto equal_range(auto const& k) noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](detail::equal_range(root_, {}, k));
+    auto const [nl, g](
+      detail::equal_range(root_, {}, detail::key_view(k), cmp_));
 
-    return std::pair(iterator(&root_, nl), iterator(&root_, g));
+    return std::pair(iterator(this, nl), iterator(this, g));
   }
 
-  auto equal_range(key_type const k) noexcept { return equal_range<0>(k); }
+  auto equal_range(key_type const& k) noexcept { return equal_range<0>(k); }
 
   template <int = 0>
   auto equal_range(auto const& k) const noexcept
-    requires(detail::Comparable<Compare, decltype(k), key_type>)
+    requires(detail::Lookup<Compare, decltype(k), key_type>)
   {
-    auto const [nl, g](detail::equal_range(root_, {}, k));
+    auto const [nl, g](
+      detail::equal_range(root_, {}, detail::key_view(k), cmp_));
 
-    return std::pair(const_iterator(&root_, nl), const_iterator(&root_, g));
+    return std::pair(const_iterator(this, nl), const_iterator(this, g));
   }
 
-  auto equal_range(key_type const k) const noexcept
+  auto equal_range(key_type const& k) const noexcept
   {
     return equal_range<0>(k);
   }
@@ -167,16 +371,19 @@ public:
   //
   template <int = 0>
   size_type erase(auto&& k)
-    noexcept(noexcept(detail::erase(root_, k)))
-    requires(detail::Comparable<Compare, decltype(k), key_type> &&
+    noexcept(noexcept(detail::erase(alloc_, root_, detail::key_view(k), cmp_)))
+    requires(detail::Lookup<Compare, decltype(k), key_type> &&
       !std::convertible_to<decltype(k), const_iterator>)
   {
-    return bool(
-        std::get<0>(detail::erase(root_, std::forward<decltype(k)>(k)))
-      );
+    auto const s(std::get<2>(
+      detail::erase(alloc_, root_, detail::key_view(k), cmp_)));
+
+    if (s && detail::erased<node>(n_, m_)) rebuild();
+
+    return s;
   }
 
-  auto erase(key_type const k)
+  auto erase(key_type const& k)
     noexcept(noexcept(erase<0>(k)))
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
@@ -186,32 +393,200 @@ public:
   iterator erase(const_iterator const i)
     noexcept(noexcept(
         detail::erase(
+          alloc_,
           root_,
           const_cast<node*>(i.n_),
-          const_cast<node*>(i.p_)
+          const_cast<node*>(i.p_),
+          cmp_
         )
       )
     )
   {
-    return {
-        &root_,
-        detail::erase(
-          root_,
-          const_cast<node*>(i.n_),
-          const_cast<node*>(i.p_)
-        )
-      };
+    auto const [n, p](
+      detail::erase(
+        alloc_,
+        root_,
+        const_cast<node*>(i.n_),
+        const_cast<node*>(i.p_),
+        cmp_
+      )
+    );
+
+    if (detail::erased<node>(n_, m_))
+    { // the parent of n changes
+      rebuild();
+
+      if (n) return {this, detail::find(root_, {}, n->key(), cmp_)};
+    }
+
+    return {this, n, p};
+  }
+
+  iterator erase(const_iterator const a, const_iterator const b) noexcept
+  { // [a, b) is cut out as one subtree
+    if (auto const n(const_cast<node*>(b.n_)); a == b)
+    {
+      return {this, n, const_cast<node*>(b.p_)};
+    }
+    else if (n)
+    {
+      auto const& k(n->key());
+      detail::erase_range(alloc_, root_, a.n_->key(), &k, cmp_);
+      n_ = detail::node_count(root_); m_ = {};
+
+      return {this, detail::find(root_, {}, k, cmp_)};
+    }
+    else
+    {
+      detail::erase_range(alloc_, root_, a.n_->key(), decltype(&n->key()){},
+        cmp_);
+      n_ = detail::node_count(root_); m_ = {};
+
+      return end();
+    }
+  }
+
+  //
+  node_type extract(const_iterator const i) noexcept
+  {
+    auto const n(const_cast<node*>(i.n_));
+    detail::unlink(root_, n, const_cast<node*>(i.p_), cmp_);
+    if (detail::erased<node>(n_, m_)) rebuild();
+
+    return {n, alloc_};
+  }
+
+  template <int = 0>
+  node_type extract(auto const& k) noexcept
+    requires(detail::Lookup<Compare, decltype(k), key_type> &&
+      !std::convertible_to<decltype(k), const_iterator>)
+  {
+    auto const [n, p](detail::find(root_, {}, detail::key_view(k), cmp_));
+
+    return n ? extract(const_iterator(this, n, p)) : node_type();
+  }
+
+  auto extract(key_type const& k) noexcept { return extract<0>(k); }
+
+  insert_return_type insert(node_type&& nh) noexcept
+  {
+    if (nh)
+    {
+      if (auto const [n, p, s](detail::insert(root_, n_, nh.n_, cmp_)); s)
+      {
+        nh.release();
+
+        return {{this, n, p}, true, {}};
+      }
+      else
+      {
+        return {{this, n, p}, false, std::move(nh)};
+      }
+    }
+    else
+    {
+      return {end(), false, {}};
+    }
+  }
+
+  // the nodes of o with keys already present stay in o
+  void merge(this_class& o) noexcept
+  {
+    detail::merge(
+      root_,
+      o.root_,
+      n_,
+      cmp_,
+      detail::fix_size,
+      [this](auto& r, auto& c, auto const n) noexcept
+      {
+        return detail::insert(r, c, n, cmp_);
+      },
+      [](auto, auto) noexcept { return false; }
+    );
+
+    o.n_ = detail::node_count(o.root_); m_ = o.m_ = {};
+  }
+
+  void merge(this_class&& o) noexcept { merge(o); }
+
+  // the keys not less than k move into the returned container
+  template <int = 0>
+  this_class split(auto const& k) noexcept
+    requires(detail::Comparable<Compare, decltype(k), key_type>)
+  {
+    this_class r(cmp_, alloc_);
+    r.root_ = detail::split(root_, k, cmp_);
+    r.n_ = detail::node_count(r.root_);
+    n_ = detail::node_count(root_); m_ = {};
+
+    return r;
+  }
+
+  auto split(key_type const k) noexcept { return split<0>(k); }
+
+  // the keys of o have to be all less or all greater than the ones here
+  void join(this_class& o) noexcept
+  {
+    detail::join(root_, o.root_, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  void join(this_class&& o) noexcept { join(o); }
+
+  // a read-only copy, laid out for searches, see frozen.hpp
+  auto freeze() const
+  {
+    return frozen<Key, value_type, Compare, Allocator>(*this);
+  }
+
+  // rebalance the whole tree, see default_policy::deferred
+  void rebuild() noexcept { detail::rebuild(root_); m_ = n_; }
+
+  // rebalance scapegoats for at most about budget steps, returns the rest,
+  // a global rebuild due after erasures goes first, if the budget covers it
+  size_type maybe_rebalance(size_type const budget) noexcept
+    requires(Policy::sized)
+  {
+    if (detail::shrunk<node>(n_, m_) && (n_ <= budget))
+    {
+      rebuild();
+
+      return budget - n_;
+    }
+
+    return detail::maybe_rebalance(root_, budget, cmp_);
+  }
+
+  // the keys in [lo, hi) are erased
+  template <int = 0>
+  void erase_range(auto const& lo, auto const& hi) noexcept
+    requires(detail::Comparable<Compare, decltype(lo), key_type> &&
+      detail::Comparable<Compare, decltype(hi), key_type>)
+  {
+    detail::erase_range(alloc_, root_, lo, &hi, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  void erase_range(key_type const lo, key_type const hi) noexcept
+  {
+    erase_range<0>(lo, hi);
   }
 
   //
   template <int = 0>
   auto insert(auto&& k)
-    noexcept(noexcept(node::emplace(root_, std::forward<decltype(k)>(k))))
+    noexcept(noexcept(
+        node::emplace(alloc_, root_, n_, cmp_, std::forward<decltype(k)>(k))
+      )
+    )
     requires(detail::Comparable<Compare, decltype(k), key_type>)
   {
-    auto const [n, p, s](node::emplace(root_, std::forward<decltype(k)>(k)));
+    auto const [n, p, s](
+      node::emplace(alloc_, root_, n_, cmp_, std::forward<decltype(k)>(k))
+    );
 
-    return std::pair(iterator(&root_, n, p), s);
+    return std::pair(iterator(this, n, p), s);
   }
 
   auto insert(key_type k)
@@ -220,6 +595,20 @@ public:
     return insert<0>(std::move(k));
   }
 
+  template <int = 0>
+  iterator insert(const_iterator const h, auto&& k)
+    noexcept(noexcept(emplace_hint(h, std::forward<decltype(k)>(k))))
+    requires(detail::Comparable<Compare, decltype(k), key_type>)
+  {
+    return emplace_hint(h, std::forward<decltype(k)>(k));
+  }
+
+  auto insert(const_iterator const h, key_type k)
+    noexcept(noexcept(insert<0>(h, std::move(k))))
+  {
+    return insert<0>(h, std::move(k));
+  }
+
   void insert(std::input_iterator auto const i, decltype(i) j)
     noexcept(noexcept(emplace(*i)))
   {
@@ -232,34 +621,51 @@ public:
       }
     );
   }
+
+  // a sorted range goes in with a single walk, see detail::insert_batch()
+  void insert_batch(std::forward_iterator auto const i, decltype(i) j)
+  {
+    node::insert_batch(alloc_, root_, i, j, cmp_);
+    n_ = detail::node_count(root_); m_ = {};
+  }
+
+  // the keys in a sorted range are erased with a single walk
+  size_type erase_batch(std::forward_iterator auto const i, decltype(i) j)
+    noexcept
+  {
+    auto const c(detail::erase_batch(alloc_, root_, i, j, cmp_));
+    n_ = detail::node_count(root_); m_ = {};
+
+    return c;
+  }
 };
 
 //////////////////////////////////////////////////////////////////////////////
-template <int = 0, typename K, class C>
-inline auto erase(set<K, C>& c, auto const& k)
+template <int = 0, typename K, class C, class A, class P>
+inline auto erase(set<K, C, A, P>& c, auto const& k)
   noexcept(noexcept(c.erase(K(k))))
-  requires(!detail::Comparable<C, decltype(k), K>)
+  requires(!detail::Lookup<C, decltype(k), K>)
 {
   return c.erase(K(k));
 }
 
-template <int = 0, typename K, class C>
-inline auto erase(set<K, C>& c, auto const& k)
+template <int = 0, typename K, class C, class A, class P>
+inline auto erase(set<K, C, A, P>& c, auto const& k)
   noexcept(noexcept(c.erase(k)))
-  requires(detail::Comparable<C, decltype(k), K>)
+  requires(detail::Lookup<C, decltype(k), K>)
 {
   return c.erase(k);
 }
 
-template <typename K, class C>
-inline auto erase(set<K, C>& c, K const k)
+template <typename K, class C, class A, class P>
+inline auto erase(set<K, C, A, P>& c, K const& k)
   noexcept(noexcept(erase<0>(c, k)))
 {
   return erase<0>(c, k);
 }
 
-template <typename K, class C>
-inline auto erase_if(set<K, C>& c, auto pred)
+template <typename K, class C, class A, class P>
+inline auto erase_if(set<K, C, A, P>& c, auto pred)
   noexcept(noexcept(pred(std::declval<K const&>()), c.erase(c.begin())))
 {
   typename std::remove_reference_t<decltype(c)>::size_type r{};
@@ -270,8 +676,8 @@ inline auto erase_if(set<K, C>& c, auto pred)
 }
 
 //////////////////////////////////////////////////////////////////////////////
-template <typename K, class C>
-inline void swap(set<K, C>& l, decltype(l) r) noexcept { l.swap(r); }
+template <typename K, class C, class A, class P>
+inline void swap(set<K, C, A, P>& l, decltype(l) r) noexcept { l.swap(r); }
 
 }
 
@@ -0,0 +1,196 @@
+#ifndef XSG_SLABALLOCATOR_HPP
+# define XSG_SLABALLOCATOR_HPP
+# pragma once
+
+#include <cstddef>
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace xsg
+{
+
+namespace detail
+{
+
+struct slabpage { slabpage* next_; };
+
+struct slabpool
+{ // the pages of slots of one size and alignment
+  slabpool* next_;
+
+  std::size_t const size_, align_; // of a page
+
+  slabpage* pages_{};
+  void* free_{};
+  std::size_t c_{}; // slots left in the current page
+};
+
+struct slabs
+{ // the pools of a slaballocator, shared by its copies and rebinds
+  slabpool* pools_{};
+
+  ~slabs() noexcept
+  {
+    release();
+
+    for (auto p(pools_); p;) delete std::exchange(p, p->next_);
+  }
+
+  void release() noexcept
+  {
+    for (auto p(pools_); p; p = p->next_)
+    {
+      for (auto g(p->pages_); g;)
+      {
+        ::operator delete(std::exchange(g, g->next_), p->size_,
+          std::align_val_t(p->align_));
+      }
+
+      p->pages_ = {}; p->free_ = {}; p->c_ = {};
+    }
+  }
+};
+
+}
+
+// Carves single objects out of large contiguous pages. Copies and rebinds
+// share the pages, and compare equal, so nodes may change hands between
+// containers whose allocators were copied from one another, while a
+// container copy starts out with pages of its own. Freed slots are kept on
+// a free list until the last allocator sharing the pages goes, or release()
+// drops them all at once. Allocators sharing pages must not be used from
+// different threads at the same time.
+template <typename T, std::size_t N = 1024>
+class slaballocator
+{
+  static_assert(N);
+
+  template <typename, std::size_t> friend class slaballocator;
+
+  union slot
+  {
+    slot* next_;
+    alignas(T) std::byte v_[sizeof(T)];
+  };
+
+  struct page
+  {
+    detail::slabpage h_; // first, so the pool frees pages without knowing T
+    slot s_[N];
+  };
+
+  std::shared_ptr<detail::slabs> s_;
+  detail::slabpool* p_{}; // the pool for slots of T, found when first used
+
+  auto& pool()
+  { // slots of equal size and alignment share a pool, whatever their type
+    for (auto p(s_->pools_); p; p = p->next_)
+    {
+      if ((sizeof(page) == p->size_) && (alignof(page) == p->align_))
+      {
+        return *p;
+      }
+    }
+
+    return *(s_->pools_ =
+      new detail::slabpool{s_->pools_, sizeof(page), alignof(page)});
+  }
+
+public:
+  using value_type = T;
+
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+
+  using propagate_on_container_copy_assignment = std::false_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  template <typename U>
+  struct rebind { using other = slaballocator<U, N>; };
+
+public:
+  slaballocator(): s_(std::make_shared<detail::slabs>()) { }
+
+  slaballocator(slaballocator const&) = default;
+
+  template <typename U>
+  slaballocator(slaballocator<U, N> const& o) noexcept: s_(o.s_) { }
+
+  //
+  slaballocator& operator=(slaballocator const&) = default;
+
+  //
+  template <typename U>
+  bool operator==(slaballocator<U, N> const& o) const noexcept
+  {
+    return s_ == o.s_;
+  }
+
+  //
+  slaballocator select_on_container_copy_construction() const
+  {
+    return {};
+  }
+
+  //
+  T* allocate(size_type const n)
+  {
+    if (1 != n) [[unlikely]] return std::allocator<T>().allocate(n);
+
+    auto& p(p_ ? *p_ : *(p_ = &pool()));
+
+    slot* s;
+
+    if (p.free_)
+    {
+      p.free_ = (s = static_cast<slot*>(p.free_))->next_;
+    }
+    else
+    {
+      if (!p.c_)
+      {
+        auto const g(::new(::operator new(sizeof(page),
+          std::align_val_t(alignof(page)))) page);
+        g->h_.next_ = p.pages_;
+
+        p.pages_ = &g->h_;
+        p.c_ = N;
+      }
+
+      s = &reinterpret_cast<page*>(p.pages_)->s_[N - p.c_--];
+    }
+
+    return reinterpret_cast<T*>(s->v_);
+  }
+
+  void deallocate(T* const p, size_type const n) noexcept
+  {
+    if (1 == n) [[likely]]
+    {
+      auto& q(p_ ? *p_ : *(p_ = &pool())); // an equal allocator made it
+      auto const s(reinterpret_cast<slot*>(p));
+
+      s->next_ = static_cast<slot*>(q.free_);
+      q.free_ = s;
+    }
+    else
+    {
+      std::allocator<T>().deallocate(p, n);
+    }
+  }
+
+  // whether no other allocator shares the pages
+  bool unique() const noexcept { return 1 == s_.use_count(); }
+
+  // frees all shared pages, objects still living in them are not destroyed
+  void release() noexcept { s_->release(); }
+};
+
+}
+
+#endif // XSG_SLABALLOCATOR_HPP
@@ -2,30 +2,135 @@
 #define XSG_UTILS_HPP
 # pragma once
 
-#if defined(_WIN32)
-# include <malloc.h>
-# define XSG_ALLOCA(x) _alloca(x)
-#else
-# include <stdlib.h>
-# define XSG_ALLOCA(x) alloca(x)
-#endif // XSG_ALLOCA
-
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <compare>
-
-#include <numeric> // std::midpoint()
+#include <limits>
+#include <memory>
+#include <ratio>
+#include <string_view>
 #include <tuple>
 #include <utility>
 
+namespace xsg
+{
+
+struct default_policy
+{
+  static constexpr bool sized{}; // cache subtree sizes in nodes
+
+  // a subtree is rebuilt when a child holds more than alpha of its nodes,
+  // a smaller alpha makes for lower trees, but more frequent rebuilds
+  using alpha = std::ratio<2, 3>;
+
+  // insertions only rebuild a subtree, when the path to the new node got
+  // longer than twice the binary logarithm of its size, erasures leave the
+  // global rebuild they make due to rebuild() and maybe_rebalance()
+  static constexpr bool deferred{};
+
+  // nodes cache prefix()(key) next to their links, so that keys with unequal
+  // prefixes compare without loading the keys; the prefixes, integers say,
+  // have to order the keys as the comparator does, void caches nothing
+  using prefix = void;
+
+  // searches prefetch both children of a node, before comparing its key, so
+  // that the next node is on its way while the comparison resolves, this
+  // pays off once the tree no longer fits in the cache
+  static constexpr bool prefetch{};
+};
+
+// abbreviates byte string keys to their first 8 bytes, read as a big-endian
+// integer and padded with zeros, which orders them as std::char_traits does
+struct string_prefix
+{
+  static std::uint64_t abbreviate(auto const s) noexcept
+  {
+    std::uint64_t r{};
+
+    if (auto const n(std::min(s.size(), sizeof(r))); n)
+    {
+      std::memcpy(&r, s.data(), n);
+    }
+
+    if constexpr(std::endian::native == std::endian::little)
+    { // byte swap, compilers turn this into a single instruction
+      r = (r & 0x00000000ffffffffu) << 32 | (r & 0xffffffff00000000u) >> 32;
+      r = (r & 0x0000ffff0000ffffu) << 16 | (r & 0xffff0000ffff0000u) >> 16;
+      r = (r & 0x00ff00ff00ff00ffu) << 8 | (r & 0xff00ff00ff00ff00u) >> 8;
+    }
+
+    return r;
+  }
+
+  auto operator()(std::string_view const s) const noexcept
+  {
+    return abbreviate(s);
+  }
+
+  auto operator()(std::u8string_view const s) const noexcept
+  {
+    return abbreviate(s);
+  }
+};
+
+// nodes of std::string or std::u8string keys cache their abbreviations, the
+// comparator has to order the keys as std::compare_three_way does
+struct string_prefix_policy: default_policy
+{
+  using prefix = string_prefix;
+};
+
+// the range is sorted and free of equivalent keys
+struct sorted_unique_t { explicit sorted_unique_t() = default; };
+inline constexpr sorted_unique_t sorted_unique{};
+
+// the range is sorted
+struct sorted_equivalent_t { explicit sorted_equivalent_t() = default; };
+inline constexpr sorted_equivalent_t sorted_equivalent{};
+
+}
+
 namespace xsg::detail
 {
 
 using difference_type = std::ptrdiff_t;
 using size_type = std::size_t;
 
+struct empty_t {};
+
+template <class P>
+using node_size_t = std::conditional_t<P::sized, size_type, empty_t>;
+
+template <class N>
+concept Sized = std::same_as<
+  std::remove_cv_t<decltype(std::remove_cvref_t<N>::s_)>,
+  size_type
+>;
+
+template <class N>
+concept Deferred = std::remove_cvref_t<N>::policy::deferred;
+
+template <class N>
+concept Prefetching = std::remove_cvref_t<N>::policy::prefetch;
+
+template <class P, class K>
+using node_prefix_t = typename std::conditional_t<
+  std::is_void_v<typename P::prefix>,
+  std::type_identity<empty_t>,
+  std::invoke_result<typename P::prefix const, K const&>
+>::type;
+
+template <class N>
+concept Prefixed = !std::same_as<
+  std::remove_cv_t<decltype(std::remove_cvref_t<N>::h_)>,
+  empty_t
+>;
+
 template <class C, class U, class V>
 concept Comparable =
   !std::is_void_v<
@@ -36,6 +141,33 @@ concept Comparable =
     >
   >;
 
+template <class C>
+concept Transparent =
+  requires { typename std::remove_cvref_t<C>::is_transparent; };
+
+// character arrays, string literals among them, are looked up as string
+// views, the comparators would not take them as they are
+inline decltype(auto) key_view(auto&& k) noexcept
+{
+  using T = std::remove_cvref_t<decltype(k)>;
+
+  if constexpr(std::is_array_v<T>)
+  {
+    return std::basic_string_view<std::remove_cv_t<std::remove_extent_t<T>>>(k);
+  }
+  else
+  {
+    return std::forward<decltype(k)>(k);
+  }
+}
+
+// keys of other types are looked up as they are, without converting them to
+// the key type, only if the comparator is transparent, as in std::map
+template <class C, class U, class K>
+concept Lookup =
+  (Transparent<C> || std::same_as<std::remove_cvref_t<U>, K>) &&
+  Comparable<C, decltype(key_view(std::declval<U>())), K>;
+
 inline auto assign(auto& ...a) noexcept
 { // assign idiom
   return [&](auto const ...b) noexcept { assign((a = b)...); };
@@ -57,6 +189,21 @@ inline auto right_node(auto const n, decltype(n) p) noexcept
   return std::remove_const_t<decltype(n)>(conv(p) ^ n->r_);
 }
 
+inline void prefetch(auto const ...a) noexcept
+{ // a hint, invalid addresses are fine
+#if defined(__GNUC__)
+  (__builtin_prefetch(a), ...);
+#endif // __GNUC__
+}
+
+inline void prefetch_children(auto const n, decltype(n) p) noexcept
+{
+  if constexpr(Prefetching<std::remove_pointer_t<decltype(n)>>)
+  {
+    prefetch(left_node(n, p), right_node(n, p));
+  }
+}
+
 inline auto first_node(auto n, decltype(n) p) noexcept
 {
   for (decltype(n) l; (l = left_node(n, p)); assign(n, p)(l, n));
@@ -72,10 +219,58 @@ inline auto last_node(auto n, decltype(n) p) noexcept
 }
 
 //
-inline auto next_node(auto n, decltype(n) p) noexcept
+inline auto key_prefix(auto const n, auto const& k) noexcept
+{ // the prefix of k, if nodes like n cache prefixes the policy can take k to
+  using node = std::remove_pointer_t<decltype(n)>;
+
+  if constexpr(Prefixed<node>)
+  {
+    using prefix = typename node::policy::prefix;
+
+    if constexpr(std::is_invocable_v<prefix const, decltype(k)>)
+    {
+      return prefix()(k);
+    }
+    else
+    {
+      return empty_t();
+    }
+  }
+  else
+  {
+    return empty_t();
+  }
+}
+
+inline auto compare(auto const& k, auto const& h, auto const n,
+  auto const& cmp) noexcept
+{ // compare k, whose prefix is h, with the key of n, prefixes first
+  using result = decltype(cmp(k, n->key()));
+
+  if constexpr(!std::same_as<std::remove_cvref_t<decltype(h)>, empty_t>)
+  {
+    if (h != n->h_) return h < n->h_ ? result::less : result::greater;
+  }
+
+  return cmp(k, n->key());
+}
+
+inline auto compare(auto const n, decltype(n) m, auto const& cmp) noexcept
+{ // compare the keys of n and m
+  if constexpr(Prefixed<std::remove_pointer_t<decltype(n)>>)
+  {
+    return compare(n->key(), n->h_, m, cmp);
+  }
+  else
+  {
+    return cmp(n->key(), m->key());
+  }
+}
+
+//
+inline auto next_node(auto n, decltype(n) p, auto const& cmp) noexcept
 {
   using pointer = std::remove_cvref_t<decltype(n)>;
-  using node = std::remove_const_t<std::remove_pointer_t<decltype(n)>>;
 
   if (auto const r(right_node(n, p)); r)
   {
@@ -83,9 +278,9 @@ inline auto next_node(auto n, decltype(n) p) noexcept
   }
   else
   {
-    for (auto const& key(n->key()); p;)
+    for (auto const m(n); p;)
     {
-      if (node::cmp(key, p->key()) < 0)
+      if (compare(m, p, cmp) < 0)
       {
         return std::pair(p, left_node(p, n));
       }
@@ -99,9 +294,8 @@ inline auto next_node(auto n, decltype(n) p) noexcept
   return std::pair(pointer{}, pointer{});
 }
 
-inline auto prev_node(auto n, decltype(n) p) noexcept
+inline auto prev_node(auto n, decltype(n) p, auto const& cmp) noexcept
 {
-  using node = std::remove_const_t<std::remove_pointer_t<decltype(n)>>;
   using pointer = std::remove_cvref_t<decltype(n)>;
 
   if (auto const l(left_node(n, p)); l)
@@ -110,9 +304,9 @@ inline auto prev_node(auto n, decltype(n) p) noexcept
   }
   else
   {
-    for (auto const& key(n->key()); p;)
+    for (auto const m(n); p;)
     {
-      if (node::cmp(key, p->key()) < 0)
+      if (compare(m, p, cmp) < 0)
       {
         assign(n, p)(p, left_node(p, n));
       }
@@ -137,32 +331,233 @@ inline size_type height(auto const n, decltype(n) p) noexcept
 
 inline size_type size(auto const n, decltype(n) p) noexcept
 {
-  return n ? 1 + size(left_node(n, p), n) + size(right_node(n, p), n) : 0;
+  if constexpr(Sized<std::remove_pointer_t<decltype(n)>>)
+  {
+    return n ? n->s_ : 0;
+  }
+  else
+  {
+    return n ? 1 + size(left_node(n, p), n) + size(right_node(n, p), n) : 0;
+  }
+}
+
+inline size_type node_count(auto const r) noexcept
+{ // the nodes below the root r, if they count them, else 0, for not known
+  if constexpr(Sized<std::remove_pointer_t<decltype(r)>>)
+  {
+    return size(r, {});
+  }
+  else
+  {
+    return {};
+  }
+}
+
+inline auto nth(auto n, decltype(n) p, size_type k) noexcept
+{ // the k-th node in order, counting from 0
+  while (n)
+  {
+    auto const l(left_node(n, p));
+
+    if (auto const sl(size(l, n)); k < sl)
+    {
+      assign(n, p)(l, n);
+    }
+    else if (k > sl)
+    {
+      k -= sl + 1;
+      assign(n, p)(right_node(n, p), n);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  return std::pair(n, p);
+}
+
+inline size_type rank(auto n, decltype(n) p, auto const& k,
+  auto const& cmp) noexcept
+  requires(Comparable<decltype(cmp), decltype(k), decltype(n->key())>)
+{ // the number of nodes with keys less than k
+  auto const h(key_prefix(n, k));
+
+  size_type r{};
+
+  while (n)
+  {
+    if (auto const c(compare(k, h, n, cmp)); c < 0)
+    {
+      assign(n, p)(left_node(n, p), n);
+    }
+    else
+    {
+      auto const l(left_node(n, p));
+
+      r += size(l, n);
+
+      if (c > 0)
+      {
+        ++r;
+        assign(n, p)(right_node(n, p), n);
+      }
+      else
+      {
+        break;
+      }
+    }
+  }
+
+  return r;
+}
+
+inline void shrink_path(auto n, decltype(n) p, auto const& cmp) noexcept
+{ // decrement cached sizes of p and all of its ancestors
+  using node = std::remove_pointer_t<decltype(n)>;
+
+  if constexpr(Sized<node>)
+  {
+    for (; p; assign(n, p)(p, compare(n, p, cmp) < 0 ?
+      left_node(p, n) : right_node(p, n)))
+    {
+      --p->s_;
+    }
+  }
 }
 
 //
-inline void destroy(auto const n, decltype(n) p)
-  noexcept(noexcept(delete n))
+inline auto new_node(auto& al, auto&& ...a)
+  noexcept(noexcept(
+      std::allocator_traits<std::remove_reference_t<decltype(al)>>::construct(
+        al,
+        std::allocator_traits<std::remove_reference_t<decltype(al)>>::allocate(
+          al,
+          1
+        ),
+        std::forward<decltype(a)>(a)...
+      )
+    )
+  )
+{
+  using traits = std::allocator_traits<std::remove_reference_t<decltype(al)>>;
+
+  auto const n(traits::allocate(al, 1));
+
+  if constexpr(noexcept(traits::construct(al, n,
+    std::forward<decltype(a)>(a)...)))
+  {
+    traits::construct(al, n, std::forward<decltype(a)>(a)...);
+  }
+  else
+  {
+    try
+    {
+      traits::construct(al, n, std::forward<decltype(a)>(a)...);
+    }
+    catch (...)
+    {
+      traits::deallocate(al, n, 1);
+
+      throw;
+    }
+  }
+
+  return n;
+}
+
+inline void delete_node(auto& al, auto const n) noexcept
 {
+  using traits = std::allocator_traits<std::remove_reference_t<decltype(al)>>;
+
+  traits::destroy(al, n);
+  traits::deallocate(al, n, 1);
+}
+
+//
+template <bool D = true>
+inline void destroy(auto& al, auto n, decltype(n) p) noexcept
+{ // rotate left children up until the top node can go, O(1) extra memory
+  using traits = std::allocator_traits<std::remove_reference_t<decltype(al)>>;
+
   if (n)
+  { // links of the top node are kept relative to a null parent
+    auto const pc(conv(p));
+    n->l_ ^= pc; n->r_ ^= pc;
+  }
+
+  while (n)
   {
-    destroy(left_node(n, p), n);
-    destroy(right_node(n, p), n);
+    if (auto const l(left_node(n, {})); l)
+    { // l takes the place of n, n becomes the right child of l
+      auto const lr(right_node(l, n));
+
+      l->l_ ^= conv(n);
+      l->r_ = conv(n);
+
+      n->l_ = conv(lr, l);
+      n->r_ ^= conv(l);
+
+      if (lr)
+      {
+        auto const c(conv(l, n));
+        lr->l_ ^= c; lr->r_ ^= c;
+      }
+
+      n = l;
+    }
+    else
+    {
+      auto const r(right_node(n, {}));
+
+      if (r)
+      {
+        auto const c(conv(n));
+        r->l_ ^= c; r->r_ ^= c;
+      }
+
+      if constexpr(D) delete_node(al, n); else traits::destroy(al, n);
+
+      n = r;
+    }
+  }
+}
+
+inline void destroy(auto& al, auto& r) noexcept
+{
+  using node = std::remove_pointer_t<std::remove_reference_t<decltype(r)>>;
+
+  if constexpr(requires{ al.release(); al.unique(); })
+  { // an arena drops all of its pages at once, unless they are shared
+    if (al.unique())
+    {
+      if constexpr(!std::is_trivially_destructible_v<node>)
+      {
+        destroy<false>(al, r, {});
+      }
 
-    delete n;
+      al.release(); r = {};
+
+      return;
+    }
   }
+
+  destroy(al, r, {}); r = {};
 }
 
-inline auto equal_range(auto n, decltype(n) p, auto const& k) noexcept
-  requires(Comparable<decltype(n->cmp), decltype(k), decltype(n->key())>)
+inline auto equal_range(auto n, decltype(n) p, auto const& k,
+  auto const& cmp) noexcept
+  requires(Comparable<decltype(cmp), decltype(k), decltype(n->key())>)
 {
-  using node = std::remove_const_t<std::remove_pointer_t<decltype(n)>>;
+  auto const h(key_prefix(n, k));
 
   decltype(n) gn{}, gp{};
 
   while (n)
   {
-    if (auto const c(node::cmp(k, n->key())); c < 0)
+    prefetch_children(n, p);
+
+    if (auto const c(compare(k, h, n, cmp)); c < 0)
     {
       assign(gn, gp, n, p)(n, p, left_node(n, p), n);
     }
@@ -187,14 +582,17 @@ inline auto equal_range(auto n, decltype(n) p, auto const& k) noexcept
     );
 }
 
-inline auto find(auto n, decltype(n) p, auto const& k) noexcept
-  requires(Comparable<decltype(n->cmp), decltype(k), decltype(n->key())>)
+inline auto find(auto n, decltype(n) p, auto const& k,
+  auto const& cmp) noexcept
+  requires(Comparable<decltype(cmp), decltype(k), decltype(n->key())>)
 {
-  using node = std::remove_const_t<std::remove_pointer_t<decltype(n)>>;
+  auto const h(key_prefix(n, k));
 
   while (n)
   {
-    if (auto const c(node::cmp(k, n->key())); c < 0)
+    prefetch_children(n, p);
+
+    if (auto const c(compare(k, h, n, cmp)); c < 0)
     {
       assign(n, p)(left_node(n, p), n);
     }
@@ -211,11 +609,14 @@ inline auto find(auto n, decltype(n) p, auto const& k) noexcept
   return std::pair(n, p);
 }
 
-inline auto erase(auto& r0, auto const pp, decltype(pp) p, decltype(pp) n,
-  std::uintptr_t* const q)
-  noexcept(noexcept(delete r0))
-{
-  auto [nnn, nnp](next_node(n, p));
+inline auto unlink(auto& r0, auto const pp, decltype(pp) p, decltype(pp) n,
+  std::uintptr_t* const q, auto const& cmp) noexcept
+{ // detach n from the tree, leaving it to the caller
+  using node = std::remove_pointer_t<decltype(n)>;
+
+  auto [nnn, nnp](next_node(n, p, cmp));
+
+  shrink_path(n, p, cmp);
 
   // pp - p - n - lr
   if (auto const l(left_node(n, p)), r(right_node(n, p)); l && r)
@@ -224,6 +625,16 @@ inline auto erase(auto& r0, auto const pp, decltype(pp) p, decltype(pp) n,
     {
       auto const [fnn, fnp](first_node(r, n));
 
+      if constexpr(Sized<node>)
+      {
+        fnn->s_ = n->s_ - 1;
+
+        for (auto m(r), mp(n); fnn != m; assign(m, mp)(left_node(m, mp), m))
+        {
+          --m->s_;
+        }
+      }
+
       if (fnn == nnn)
       {
         nnp = p;
@@ -270,6 +681,16 @@ inline auto erase(auto& r0, auto const pp, decltype(pp) p, decltype(pp) n,
     {
       auto const [lnn, lnp](last_node(l, n));
 
+      if constexpr(Sized<node>)
+      {
+        lnn->s_ = n->s_ - 1;
+
+        for (auto m(l), mp(n); lnn != m; assign(m, mp)(right_node(m, mp), m))
+        {
+          --m->s_;
+        }
+      }
+
       if (r == nnn)
       {
         nnp = lnn;
@@ -330,23 +751,32 @@ inline auto erase(auto& r0, auto const pp, decltype(pp) p, decltype(pp) n,
     q ? *q = conv(lr, pp) : bool(r0 = lr);
   }
 
-  delete n;
-
   return std::pair(nnn, nnp);
 }
 
-inline auto erase(auto& r0, auto const& k)
-  noexcept(noexcept(delete r0))
-  requires(Comparable<decltype(r0->cmp), decltype(k), decltype(r0->key())>)
+inline auto erase(auto& al, auto& r0, auto const pp, decltype(pp) p,
+  decltype(pp) n, std::uintptr_t* const q, auto const& cmp) noexcept
 {
+  auto const r(unlink(r0, pp, p, n, q, cmp));
+
+  delete_node(al, n);
+
+  return r;
+}
+
+inline auto erase(auto& al, auto& r0, auto const& k, auto const& cmp)
+  noexcept
+  requires(Comparable<decltype(cmp), decltype(k), decltype(r0->key())>)
+{ // the successor of the erased node and whether a node with key k was found
   using pointer = std::remove_cvref_t<decltype(r0)>;
-  using node = std::remove_pointer_t<pointer>;
+
+  auto const h(key_prefix(r0, k));
 
   std::uintptr_t* q{};
 
   for (pointer n(r0), p{}, pp{}; n;)
   {
-    if (auto const c(node::cmp(k, n->key())); c < 0)
+    if (auto const c(compare(k, h, n, cmp)); c < 0)
     {
       assign(pp, p, n, q)(p, n, left_node(n, p), &n->l_);
     }
@@ -356,25 +786,26 @@ inline auto erase(auto& r0, auto const& k)
     }
     else [[unlikely]]
     {
-      return erase(r0, pp, p, n, q);
+      auto const [nn, np](erase(al, r0, pp, p, n, q, cmp));
+
+      return std::tuple(nn, np, true);
     }
   }
 
-  return std::pair(pointer{}, pointer{});
+  return std::tuple(pointer{}, pointer{}, false);
 }
 
-inline auto erase(auto& r0, auto const n, decltype(n) p)
-  noexcept(noexcept(delete r0))
+inline auto unlink(auto& r0, auto const n, decltype(n) p, auto const& cmp)
+  noexcept
 {
   using pointer = std::remove_cvref_t<decltype(r0)>;
-  using node = std::remove_pointer_t<pointer>;
 
   pointer pp{};
   std::uintptr_t* q{};
 
   if (p)
   {
-    if (node::cmp(n->key(), p->key()) < 0)
+    if (compare(n, p, cmp) < 0)
     {
       assign(pp, q)(left_node(p, n), &p->l_);
     }
@@ -384,167 +815,1302 @@ inline auto erase(auto& r0, auto const n, decltype(n) p)
     }
   }
 
-  return erase(r0, pp, p, n, q);
+  return unlink(r0, pp, p, n, q, cmp);
 }
 
-inline auto rebalance(auto const n, decltype(n) p,
-  decltype(n) q, auto& qp, size_type const sz) noexcept
+inline auto erase(auto& al, auto& r0, auto const n, decltype(n) p,
+  auto const& cmp) noexcept
 {
-  using node_t = std::remove_pointer_t<std::remove_const_t<decltype(n)>>;
+  auto const r(unlink(r0, n, p, cmp));
 
-  auto const a(static_cast<node_t**>(XSG_ALLOCA(sizeof(node_t*) * sz)));
+  delete_node(al, n);
 
-  struct S
-  {
-    std::remove_const_t<decltype(a)> b_;
+  return r;
+}
 
-    void operator()(decltype(n) n, decltype(n) p) noexcept
+inline constexpr auto fix_size(
+  [](auto const n, decltype(n) l, decltype(n) r) noexcept
+  {
+    if constexpr(Sized<std::remove_pointer_t<decltype(n)>>)
     {
-      if (n)
-      {
-        operator()(detail::left_node(n, p), n);
+      n->s_ = 1 + (l ? l->s_ : 0) + (r ? r->s_ : 0);
+    }
+  }
+);
 
-        *b_++ = n;
+inline auto build(auto h, size_type const sz, auto const& fix) noexcept
+{ // link a thread of sz nodes, chained in order through l_, into a
+  // perfectly balanced tree, the low bit of each l_ is ignored
+  using node_t = std::remove_pointer_t<decltype(h)>;
 
-        operator()(detail::right_node(n, p), n);
+  // children are linked relative to a null parent at first
+  auto const link([](node_t* const c, node_t* const n) noexcept
+    {
+      if (c)
+      {
+        auto const cn(conv(n));
+        c->l_ ^= cn; c->r_ ^= cn;
       }
     }
-  };
+  );
+
+  struct
+  {
+    node_t* n;
+    size_type c;
+  } st[std::numeric_limits<size_type>::digits];
 
-  struct T
+  node_t* r;
+
+  for (size_type i{}, c(sz);;)
   {
-    decltype(q) q_;
-    decltype(qp) qp_;
+    for (; c; c = (c - 1) / 2) st[i++] = {{}, c - 1 - (c - 1) / 2};
 
-    node_t* f(decltype(p) p, decltype(a) a, decltype(a) b) const noexcept
+    for (r = {};; --i)
     {
-      node_t* n;
+      if (!i) return r;
 
-      if (b == a)
-      {
-        if ((n = *a) == q_) qp_ = p;
+      if (auto& [n, c1](st[i - 1]); !n)
+      { // r is the left subtree, take the next node off the thread
+        h = decltype(h)((n = h)->l_ & ~std::uintptr_t(1));
 
-        detail::assign(n->l_, n->r_)(detail::conv(p), detail::conv(p));
-      }
-      else if (b == a + 1)
-      { // n - nb
-        auto const nb(*b);
+        n->l_ = conv(r);
+        link(r, n);
 
-        if ((n = *a) == q_) qp_ = p; else if (nb == q_) qp_ = n;
+        if ((c = c1)) break;
 
-        detail::assign(nb->l_, nb->r_, n->l_, n->r_)(detail::conv(n),
-          detail::conv(n), detail::conv(p), detail::conv(p, nb));
+        r = {};
       }
-      else
-      {
-        auto const m(std::midpoint(a, b));
 
-        if ((n = *m) == q_) qp_ = p;
+      // r is the right subtree
+      auto const n(st[i - 1].n);
 
-        detail::assign(n->l_, n->r_)(
-          detail::conv(f(n, a, m - 1), p),
-          detail::conv(f(n, m + 1, b), p)
-        );
-      }
+      n->r_ = conv(r);
+      link(r, n);
 
-      return n;
+      fix(n, left_node(n, {}), r);
+
+      r = n;
     }
-  };
+  }
+}
 
-  S s{a}; s(n, p);
+inline auto clone(auto& al, auto n, auto const& create)
+{ // copy the tree node for node, the low bit of l_ marks right children
+  // in the copy until we ascend from them
+  using pointer = decltype(create(n));
+  using node_t = std::remove_pointer_t<pointer>;
 
-  return T{q, qp}.f(p, a, s.b_ - 1);
-}
+  if (!n) return pointer{};
 
-inline auto emplace(auto& r, auto const& k, auto const& create_node)
-  noexcept(noexcept(create_node({})))
-{
-  using node_t = std::remove_pointer_t<std::remove_reference_t<decltype(r)>>;
+  auto const copy([&](auto const n, pointer const p)
+    {
+      auto const m(create(n));
 
-  struct S
-  {
-    enum Direction: bool { LEFT, RIGHT };
+      m->l_ = m->r_ = conv(p);
+      if constexpr(Sized<node_t>) m->s_ = n->s_;
 
-    decltype(r) r_;
-    decltype(k) k_;
-    decltype(create_node) create_node_;
+      return m;
+    }
+  );
 
-    node_t* q_, *qp_;
-    bool s_;
+  decltype(n) p{};
+  auto const r(copy(n, {}));
+  pointer m(r), mp{};
 
-    explicit S(decltype(r) r, decltype(k) k,
-      decltype(create_node) cn) noexcept:
-      r_(r), k_(k), create_node_(cn)
+  auto const up([&]() noexcept
     {
+      auto const right(m->l_ & 1);
+      m->l_ ^= right;
+
+      right ?
+        assign(n, p, m, mp)(p, decltype(p)(conv(n) ^ p->r_),
+          mp, pointer(conv(m) ^ mp->r_)) :
+        assign(n, p, m, mp)(p, decltype(p)(conv(n) ^ p->l_),
+          mp, pointer(conv(m) ^ (mp->l_ & ~std::uintptr_t(1))));
+
+      return right;
     }
+  );
 
-    size_type operator()(node_t* n, decltype(n) p, enum Direction const d)
-      noexcept(noexcept(create_node_({})))
+  try
+  {
+    for (;;)
     {
-      size_type sl, sr;
-
-      if (auto const c(node_t::cmp(k_, n->key())); c < 0)
+      if (auto const l(left_node(n, p)); l)
       {
-        if (auto const l = left_node(n, p))
-        {
-          if (!(sl = (*this)(l, n, LEFT))) return {};
-        }
-        else
-        {
-          assign(sl, q_, qp_, s_)(1, create_node_(n), n, true);
-          n->l_ = conv(q_, p);
-        }
+        auto const ml(copy(l, m));
+        m->l_ ^= conv(ml);
 
-        sr = size(right_node(n, p), n);
+        assign(n, p, m, mp)(l, n, ml, m);
+
+        continue;
       }
-      else if (c > 0)
+
+      for (;;)
       {
-        if (auto const r = right_node(n, p))
+        if (auto const rn(right_node(n, p)); rn)
         {
-          if (!(sr = ((*this)(r, n, RIGHT)))) return {};
-        }
-        else
-        {
-          assign(sr, q_, qp_, s_)(1, create_node_(n), n, true);
-          n->r_ = conv(q_, p);
-        }
+          auto const mr(copy(rn, m));
+          m->r_ ^= conv(mr);
+          mr->l_ |= 1;
 
-        sl = size(left_node(n, p), n);
+          assign(n, p, m, mp)(rn, n, mr, m);
+
+          break;
+        }
+
+        do if (!p) return r; while (up()); // ascend past right children
+      }
+    }
+  }
+  catch (...)
+  {
+    while (p) up();
+
+    destroy(al, r, {});
+
+    throw;
+  }
+}
+
+inline auto build(auto& al, auto i, decltype(i) const j,
+  auto const& create, auto const& fix, size_type& c)
+{ // thread the nodes created from a sorted range, then link them, count them
+  using node_t = std::remove_pointer_t<decltype(create(*i, {}))>;
+
+  node_t* h{}, *t{};
+  size_type sz{};
+
+  try
+  {
+    for (; i != j; ++i)
+    {
+      if (auto const n(create(*i, t)); n) // null if appended to t
+      {
+        n->l_ = {};
+        t ? t->l_ = conv(n) : bool(h = n);
+
+        t = n; ++sz;
+      }
+    }
+  }
+  catch (...)
+  {
+    for (auto n(h); n;)
+    {
+      delete_node(al, std::exchange(n, decltype(n)(n->l_)));
+    }
+
+    throw;
+  }
+
+  return c = sz, h ? build(h, sz, fix) : h;
+}
+
+inline auto build(auto& al, auto const i, decltype(i) const j,
+  auto const& create, auto const& fix)
+{
+  size_type c;
+
+  return build(al, i, j, create, fix, c);
+}
+
+inline auto thread(auto const n, decltype(n) p) noexcept
+{ // chain the nodes of a subtree in order through l_, returns the head of
+  // the thread and its length
+  using node_t = std::remove_pointer_t<std::remove_const_t<decltype(n)>>;
+
+  node_t* h{};
+  size_type sz{};
+
+  // node addresses are even, the low bit of l_ marks a visited node
+  auto [m, mp](first_node(n, p));
+
+  for (node_t* pm{};;)
+  {
+    if (pm) pm->l_ = conv(m) | 1; else h = m;
+
+    (pm = m)->l_ = 1; ++sz;
+
+    if (auto const r(right_node(m, mp)); r)
+    {
+      std::tie(m, mp) = first_node(r, m);
+    }
+    else
+    {
+      for (;;)
+      {
+        if (n == m) goto done;
+
+        if (mp->l_ & 1)
+        { // from the right, mp was visited
+          assign(m, mp)(mp, right_node(mp, m));
+        }
+        else
+        {
+          assign(m, mp)(mp, left_node(mp, m));
+
+          break;
+        }
+      }
+    }
+  }
+
+  done:
+  return std::pair(h, sz);
+}
+
+inline auto rebalance(auto const n, decltype(n) p,
+  decltype(n) q, auto& qp, auto const& fix) noexcept
+{ // thread the nodes in order through l_, then relink them bottom-up
+  auto const [h, sz](thread(n, p));
+
+  auto const r(
+    build(
+      h,
+      sz,
+      [&](auto const n, decltype(n) l, decltype(n) r) noexcept
+      {
+        if (q && ((l == q) || (r == q))) qp = n;
+
+        fix(n, l, r);
+      }
+    )
+  );
+
+  {
+    auto const pc(conv(p));
+    r->l_ ^= pc; r->r_ ^= pc;
+
+    if (r == q) qp = p;
+  }
+
+  return r;
+}
+
+inline auto rebalance(auto const n, decltype(n) p,
+  decltype(n) q, auto& qp) noexcept
+{
+  return rebalance(n, p, q, qp, fix_size);
+}
+
+template <class N>
+constexpr bool heavy(size_type const c, size_type const s) noexcept
+{ // c out of s nodes are more than alpha of them
+  using alpha = typename std::remove_cvref_t<N>::policy::alpha;
+  static_assert((2 * alpha::num > alpha::den) && (alpha::num < alpha::den));
+
+  return alpha::den * c > alpha::num * s;
+}
+
+template <class N>
+constexpr bool scapegoat(size_type const sl, size_type const sr) noexcept
+{
+  auto const s(1 + sl + sr);
+
+  return heavy<N>(sl, s) || heavy<N>(sr, s);
+}
+
+template <class N>
+constexpr bool scapegoat(size_type const sl, size_type const sr,
+  size_type const h) noexcept
+{ // h is the length of the path from the node down to a new node
+  if constexpr(Deferred<N>)
+  {
+    return h > 2 * size_type(std::bit_width(1 + sl + sr));
+  }
+  else
+  {
+    return scapegoat<N>(sl, sr);
+  }
+}
+
+template <class N>
+constexpr bool shrunk(size_type const n, size_type const m) noexcept
+{ // n nodes are fewer than alpha of m
+  using alpha = typename std::remove_cvref_t<N>::policy::alpha;
+
+  return alpha::den * n < alpha::num * m;
+}
+
+template <class N>
+constexpr bool erased(size_type& n, size_type& m) noexcept
+{ // one of n nodes is gone, m is the most nodes since the last global
+  // rebuild, returns whether the tree is due for another one
+  if (n)
+  {
+    if (m < n) m = n;
+
+    if (--n)
+    {
+      return !Deferred<N> && shrunk<N>(n, m);
+    }
+
+    m = {};
+  }
+
+  return false;
+}
+
+template <class N>
+consteval size_type max_height() noexcept
+{ // the height up to which insertions keep a tree of any size, rounded up
+  // to a power of 2
+  using alpha = typename std::remove_cvref_t<N>::policy::alpha;
+
+  size_type h{};
+
+  if constexpr(Deferred<N>)
+  {
+    h = 2 * std::numeric_limits<size_type>::digits;
+  }
+  else
+  {
+    constexpr size_type n(alpha::num), d(alpha::den);
+
+    for (auto s(std::numeric_limits<size_type>::max()); s; ++h)
+    {
+      s = s / d * n + s % d * n / d;
+    }
+  }
+
+  return std::bit_ceil(h);
+}
+
+template <class N>
+inline constexpr auto min_size{
+  []() noexcept
+  { // the fewest nodes a tree needs for a new node h edges deep to pass the
+    // height test, h may be at most floor(log_{1/alpha}(n)) + 1
+    using alpha = typename std::remove_cvref_t<N>::policy::alpha;
+
+    constexpr size_type n(alpha::num), d(alpha::den);
+
+    std::array<size_type, max_height<N>()> a{};
+
+    for (size_type h(1), s(1); a.size() != h; ++h)
+    {
+      a[h] = s;
+      s = s > ~size_type{} / d ? ~size_type{} : (s * d + n - 1) / n;
+    }
+
+    return a;
+  }()
+};
+
+template <class N>
+constexpr bool shallow(size_type const d, size_type const c) noexcept
+{ // a new node d edges deep in a tree of c nodes needs no scapegoat, with
+  // deferred, the root bounds the height alone
+  if constexpr(Deferred<N>)
+  {
+    return d <= 2 * size_type(std::bit_width(c));
+  }
+  else
+  {
+    return (d < max_height<N>()) && (min_size<N>[d] <= c);
+  }
+}
+
+inline void rebuild(auto& r, auto const& fix) noexcept
+{ // rebalance the whole tree
+  if (r)
+  {
+    std::remove_cvref_t<decltype(r)> qp;
+
+    r = rebalance(r, {}, {}, qp, fix);
+  }
+}
+
+inline void rebuild(auto& r) noexcept { rebuild(r, fix_size); }
+
+inline auto emplace(auto& r, auto const& k, auto const& cmp,
+  auto const& create_node, auto const& fix, auto const& down,
+  auto const& found, size_type& c)
+  noexcept(noexcept(create_node({}), found(r)))
+{ // insert k below the root r, down(n) visits the nodes on the path, found(n)
+  // gets the node whose key equals k; c counts the nodes in the tree, 0 if
+  // the count is unknown, which makes every insertion look for a scapegoat
+  using node_t = std::remove_pointer_t<std::remove_reference_t<decltype(r)>>;
+
+  constexpr auto N(max_height<node_t>());
+
+  bool b[N]; // the last N turns taken, true for right
+  size_type d{}; // the length of the path
+
+  auto const h(key_prefix(r, k));
+
+  node_t* q, *qp;
+
+  for (node_t* n(r), *p{};;)
+  {
+    down(n);
+
+    if (auto const c(compare(k, h, n, cmp)); c < 0)
+    {
+      b[d++ % N] = false;
+
+      if (auto const l = left_node(n, p))
+      {
+        assign(n, p)(l, n);
+      }
+      else
+      {
+        n->l_ ^= conv(q = create_node(qp = n));
+
+        break;
+      }
+    }
+    else if (c > 0)
+    {
+      b[d++ % N] = true;
+
+      if (auto const r = right_node(n, p))
+      {
+        assign(n, p)(r, n);
+      }
+      else
+      {
+        n->r_ ^= conv(q = create_node(qp = n));
+
+        break;
+      }
+    }
+    else [[unlikely]]
+    {
+      found(n);
+
+      return std::tuple(n, p, false);
+    }
+  }
+
+  if constexpr(Sized<node_t>) c = r->s_ + 1; else if (c) ++c;
+
+  // the turns taken recover the ancestors from the xor links on the way
+  // back up, turns that fell out of the buffer are found by comparing again
+  auto const right([&](size_type const i, node_t* const n) noexcept
+    {
+      return d - i <= N ? b[i % N] : compare(k, h, n, cmp) > 0;
+    }
+  );
+
+  auto const parent([](node_t* const n, decltype(n) m, bool const right)
+    noexcept
+    {
+      return decltype(n)((right ? n->r_ : n->l_) ^ conv(m));
+    }
+  );
+
+  // m is the child of n on the path, s the size of its subtree
+  node_t* m(q), *n(qp);
+
+  // a path within the height bound needs no scapegoat
+  if (c && shallow<node_t>(d, c))
+  {
+    if constexpr(Sized<node_t>)
+    {
+      for (auto i(d - 1); ++n->s_, i;)
+      {
+        assign(m, n)(n, parent(n, m, b[i--]));
+      }
+    }
+
+    return std::tuple(q, qp, true);
+  }
+
+  for (size_type s(1), h{}, i(d - 1);; --i)
+  {
+    auto const rn(right(i, n));
+    auto const p(i ? parent(n, m, rn) : nullptr);
+
+    auto const so(size(rn ? left_node(n, p) : right_node(n, p), n));
+    auto const t(1 + s + so);
+
+    if constexpr(Sized<node_t>) n->s_ = t;
+
+    if (scapegoat<node_t>(s, so, ++h))
+    {
+      if (auto const nn(rebalance(n, p, q, qp, fix)); p)
+      {
+        right(i - 1, p) ?
+          p->r_ = conv(nn, right_node(p, n)) :
+          p->l_ = conv(nn, left_node(p, n));
+
+        // the ancestors above the scapegoat only grow
+        if constexpr(Sized<node_t>)
+        {
+          for (assign(m, n)(nn, p); ++n->s_, --i;)
+          {
+            assign(m, n)(n, parent(n, m, right(i, n)));
+          }
+        }
+      }
+      else
+      {
+        r = nn;
+      }
+
+      break;
+    }
+    else if (!i)
+    { // no scapegoat, but the whole tree was counted
+      c = t;
+
+      break;
+    }
+
+    assign(m, n, s)(n, p, t);
+  }
+
+  return std::tuple(q, qp, true);
+}
+
+inline auto emplace(auto& r, auto const& k, auto const& cmp,
+  auto const& create_node, size_type& c) noexcept(noexcept(create_node({})))
+{
+  return emplace(r, k, cmp, create_node, fix_size,
+    [](auto) noexcept {}, [](auto) noexcept {}, c);
+}
+
+inline auto emplace(auto& r, auto const& k, auto const& cmp,
+  auto const& create_node) noexcept(noexcept(create_node({})))
+{
+  size_type c{};
+
+  return emplace(r, k, cmp, create_node, c);
+}
+
+inline auto emplace(auto& r, auto const n, decltype(n) p, auto const& k,
+  auto const& cmp, auto const& create_node, auto const& fix, auto const& up,
+  auto const& miss, size_type& c)
+  noexcept(noexcept(create_node({}), miss()))
+{ // insert k right before the hint (n, p), if it belongs there, else miss(),
+  // c counts the nodes, as with the emplace() without a hint
+  using node_t = std::remove_pointer_t<std::remove_reference_t<decltype(r)>>;
+
+  node_t* q, *qp;
+
+  {
+    auto const h(key_prefix(r, k));
+
+    node_t* pn, *pp; // the node preceding the hint
+
+    if (n)
+    {
+      if (auto const c(compare(k, h, n, cmp)); c > 0)
+      {
+        return miss();
+      }
+      else if (c == 0)
+      {
+        return std::tuple(n, p, false);
+      }
+
+      std::tie(pn, pp) = prev_node(n, p, cmp);
+    }
+    else if (r)
+    {
+      std::tie(pn, pp) = last_node(r, {});
+    }
+    else
+    {
+      return miss();
+    }
+
+    if (pn)
+    {
+      if (auto const c(compare(k, h, pn, cmp)); c < 0)
+      {
+        return miss();
+      }
+      else if (c == 0)
+      {
+        return std::tuple(pn, pp, false);
+      }
+    }
+
+    // either n has no left child, or pn has no right child
+    n && !left_node(n, p) ?
+      void(n->l_ ^= conv(q = create_node(qp = n))) :
+      void(pn->r_ ^= conv(q = create_node(qp = pn)));
+  }
+
+  if constexpr(Sized<node_t>) c = r->s_ + 1; else if (c) ++c;
+
+  node_t* m(q), *mp(qp);
+
+  bool grown{}; // whether the ancestors of q were updated already
+
+  if (c)
+  { // a path within the height bound needs no scapegoat, the walk up that
+    // measures the path grows the ancestors on the way
+    size_type d{};
+
+    for (auto n(m), p(mp); p; ++d)
+    {
+      if constexpr(Sized<node_t>) ++p->s_;
+      up(p);
+
+      assign(n, p)(p, compare(n, p, cmp) < 0 ?
+        left_node(p, n) : right_node(p, n));
+    }
+
+    if (shallow<node_t>(d, c)) return std::tuple(q, qp, true);
+
+    grown = true;
+  }
+
+  // walk up and check every ancestor for a scapegoat, like emplace does
+  for (size_type s(1), h{}; mp;)
+  {
+    auto const left(compare(m, mp, cmp) < 0);
+    auto const gp(left ? left_node(mp, m) : right_node(mp, m));
+
+    auto const so(size(left ? right_node(mp, gp) : left_node(mp, gp), mp));
+    auto const t(1 + s + so);
+
+    if constexpr(Sized<node_t>) mp->s_ = t;
+    up(mp);
+
+    if (scapegoat<node_t>(s, so, ++h))
+    {
+      if (auto const nn(rebalance(mp, gp, q, qp, fix)); gp)
+      {
+        compare(nn, gp, cmp) < 0 ?
+          gp->l_ = conv(nn, left_node(gp, mp)) :
+          gp->r_ = conv(nn, right_node(gp, mp));
+
+        assign(m, mp)(nn, gp);
+      }
+      else
+      {
+        r = nn;
+
+        break;
+      }
+
+      // the ancestors above the scapegoat only grow
+      for (; !grown && mp; assign(m, mp)(mp, compare(m, mp, cmp) < 0 ?
+        left_node(mp, m) : right_node(mp, m)))
+      {
+        if constexpr(Sized<node_t>) ++mp->s_;
+        up(mp);
+      }
+
+      break;
+    }
+    else if (!gp)
+    { // no scapegoat, but the whole tree was counted
+      c = t;
+
+      break;
+    }
+
+    assign(m, mp, s)(mp, gp, t);
+  }
+
+  return std::tuple(q, qp, true);
+}
+
+inline auto emplace(auto& r, auto const n, decltype(n) p, auto const& k,
+  auto const& cmp, auto const& create_node, size_type& c)
+  noexcept(noexcept(create_node({})))
+{
+  return emplace(r, n, p, k, cmp, create_node, fix_size,
+    [](auto) noexcept {}, [&]() noexcept(noexcept(create_node({})))
+    {
+      return emplace(r, k, cmp, create_node, c);
+    },
+    c
+  );
+}
+
+inline auto insert(auto& r, size_type& c, auto const n, auto const& cmp)
+  noexcept
+{ // link a detached node, unless its key is in the tree already
+  using pointer = std::remove_cvref_t<decltype(r)>;
+
+  auto const link([n](pointer const p) noexcept
+    {
+      n->l_ = n->r_ = conv(p);
+      if constexpr(Sized<std::remove_pointer_t<pointer>>) n->s_ = 1;
+
+      return n;
+    }
+  );
+
+  return r ?
+    emplace(r, n->key(), cmp, link, c) :
+    std::tuple<pointer, pointer, bool>(r = link({}), {}, (c = 1, true));
+}
+
+inline void merge(auto& r, auto& o, size_type& c, auto const& cmp,
+  auto const& fix, auto const& insert, auto const& absorb) noexcept
+{ // move the nodes of o into r, absorb(q, n) may take over a node n with
+  // the same key as q, the nodes it rejects stay in o; c counts the nodes
+  // of r, 0 if not known, as insert(r, c, n) does
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  if (!o || (&r == &o)) return;
+
+  auto const next([](node_t* const n) noexcept
+    {
+      return decltype(n)(n->l_ & ~std::uintptr_t(1));
+    }
+  );
+
+  struct
+  {
+    node_t* h{}, *t{};
+    size_type s{};
+
+    void operator()(node_t* const n) noexcept
+    {
+      t ? void(t->l_ = conv(n) | 1) : void(h = n);
+      ++s; t = n;
+    }
+  } lc; // leftovers
+
+  auto [j, m](thread(o, {}));
+  o = {};
+
+  if (!c) c = size(r, {});
+
+  if (auto const t(c + m); m * std::bit_width(t) < t)
+  { // few nodes, insert them one by one
+    while (m--)
+    {
+      auto const k(j);
+      j = next(j);
+
+      if (auto const [q, qp, s](insert(r, c, k)); !s && !absorb(q, k))
+      {
+        lc(k);
+      }
+    }
+  }
+  else
+  { // merge both threads, then build a new tree
+    auto [i, n](r ? thread(r, {}) : std::pair<node_t*, size_type>());
+
+    decltype(lc) mc;
+
+    while (n || m)
+    {
+      if (!m || (n && (compare(i, j, cmp) < 0)))
+      {
+        auto const k(i);
+        i = next(i); --n;
+        mc(k);
+      }
+      else
+      {
+        auto const k(j);
+        j = next(j); --m;
+
+        if (n && (compare(i, k, cmp) == 0))
+        {
+          if (!absorb(i, k)) lc(k);
+        }
+        else
+        {
+          mc(k);
+        }
       }
-      else [[unlikely]]
+    }
+
+    r = build(mc.h, mc.s, fix); c = mc.s;
+  }
+
+  if (lc.s) o = build(lc.h, lc.s, fix);
+}
+
+inline auto split(auto& r, auto const& k, auto const& cmp, auto const& fix)
+  noexcept
+{ // detach the nodes with keys not less than k along a single path, r keeps
+  // the rest, the spines of both trees are fixed up bottom-up
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  node_t* lr{}, *lh{}, *lhp{}; // root, hook and its parent of the left tree
+  node_t* rr{}, *rh{}, *rhp{};
+
+  for (node_t* n(r), *p{}; n;)
+  {
+    auto const l(left_node(n, p)), rn(right_node(n, p));
+
+    if (cmp(n->key(), k) < 0)
+    { // n hangs off the left tree, its right subtree is undecided
+      auto const c(conv(p, lh));
+      n->l_ ^= c; n->r_ ^= c;
+
+      lh ? lh->r_ = conv(n, lhp) : bool(lr = n);
+      assign(lhp, lh, n, p)(lh, n, rn, n);
+    }
+    else
+    {
+      auto const c(conv(p, rh));
+      n->l_ ^= c; n->r_ ^= c;
+
+      rh ? rh->l_ = conv(n, rhp) : bool(rr = n);
+      assign(rhp, rh, n, p)(rh, n, l, n);
+    }
+  }
+
+  if (lh)
+  {
+    lh->r_ = conv(lhp);
+
+    for (auto n(lh), p(lhp); n; assign(n, p)(p, p ? right_node(p, n) : p))
+    {
+      fix(n, left_node(n, p), right_node(n, p));
+    }
+  }
+
+  if (rh)
+  {
+    rh->l_ = conv(rhp);
+
+    for (auto n(rh), p(rhp); n; assign(n, p)(p, p ? left_node(p, n) : p))
+    {
+      fix(n, left_node(n, p), right_node(n, p));
+    }
+  }
+
+  r = lr;
+
+  return rr;
+}
+
+inline auto split(auto& r, auto const& k, auto const& cmp) noexcept
+{
+  return split(r, k, cmp, fix_size);
+}
+
+inline void join(auto& r, auto& o, auto const& cmp, auto const& fix,
+  auto const& unlink) noexcept
+{ // all keys of o are either less or greater than those in r, the smaller
+  // tree goes under a node taken off its edge, on the spine of the larger
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  if (!o || (&r == &o)) return;
+
+  if (!r)
+  {
+    r = std::exchange(o, {});
+
+    return;
+  }
+
+  // r has the smaller keys
+  if (cmp(std::get<0>(first_node(o, {}))->key(),
+    std::get<0>(last_node(r, {}))->key()) < 0)
+  {
+    std::swap(r, o);
+  }
+
+  assert(cmp(std::get<0>(last_node(r, {}))->key(),
+    std::get<0>(first_node(o, {}))->key()) < 0);
+
+  bool left{}; // descend the spine of the larger tree
+  if constexpr(Sized<node_t>) left = size(r, {}) < size(o, {});
+
+  node_t* m, *s; // the middle node and the smaller tree
+
+  if (left)
+  {
+    auto const [n, p](last_node(r, {}));
+    unlink(r, m = n, p);
+
+    s = std::exchange(r, o);
+  }
+  else
+  {
+    auto const [n, p](first_node(o, {}));
+    unlink(o, m = n, p);
+
+    s = o;
+  }
+
+  o = {};
+
+  // stop where m, with the smaller tree on one side, is not a scapegoat,
+  // without cached sizes m goes on top and later insertions rebalance
+  node_t* n(r), *p{}, *pp{};
+
+  if constexpr(Sized<node_t>)
+  {
+    auto const ss(size(s, {}));
+
+    for (; n; assign(pp, p, n)(p, n, left ? left_node(n, p) : right_node(n, p)))
+    {
+      if (auto const t(size(n, p)); !heavy<node_t>(t, 1 + t + ss)) break;
+    }
+  }
+
+  if (n)
+  {
+    auto const c(conv(p, m));
+    n->l_ ^= c; n->r_ ^= c;
+  }
+
+  if (s)
+  {
+    auto const c(conv(m));
+    s->l_ ^= c; s->r_ ^= c;
+  }
+
+  left ?
+    (m->l_ = conv(s, p), m->r_ = conv(n, p)) :
+    (m->l_ = conv(n, p), m->r_ = conv(s, p));
+
+  if (p)
+  {
+    left ? p->l_ = conv(m, pp) : p->r_ = conv(m, pp);
+  }
+  else
+  {
+    r = m;
+  }
+
+  for (assign(n, p)(m, p); n;
+    assign(n, p)(p, !p ? p : left ? left_node(p, n) : right_node(p, n)))
+  {
+    fix(n, left_node(n, p), right_node(n, p));
+  }
+}
+
+inline void join(auto& r, auto& o, auto const& cmp) noexcept
+{
+  join(r, o, cmp, fix_size,
+    [&](auto& r, auto const n, auto const p) noexcept
+    {
+      unlink(r, n, p, cmp);
+    }
+  );
+}
+
+inline auto maybe_rebalance(auto& r, size_type b, auto const& cmp,
+  auto const& fix, auto const& unlink) noexcept
+  requires(Sized<std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>>)
+{ // rebalance the topmost scapegoats, heavier subtrees first, visiting a
+  // node costs 1 of the budget b and a rebuild the size of the subtree; a
+  // scapegoat too large for what is left of b has its median rotated up
+  // instead, for about twice the binary logarithm of its size, so a large
+  // rebuild is spread over many calls and the tree stays searchable between
+  // them, returns what is left of b
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  auto const f([&](auto&& f, node_t* n, decltype(n) p) noexcept -> node_t*
+    {
+      if (!n || !b) return n;
+
+      --b;
+
+      auto l(left_node(n, p)), r(right_node(n, p));
+      auto sl(size(l, n)), sr(size(r, n));
+
+      if (scapegoat<node_t>(sl, sr))
       {
-        assign(q_, qp_, s_)(n, p, false);
+        if (n->s_ <= b)
+        {
+          b -= n->s_;
+
+          node_t* qp;
+
+          return rebalance(n, p, {}, qp, fix);
+        }
+        else if (size_type const c(2 * std::bit_width(n->s_)); c <= b)
+        { // split the subtree at its median, which becomes its root
+          b -= c;
+
+          {
+            auto const c(conv(p));
+            n->l_ ^= c; n->r_ ^= c;
+          }
 
-        return {};
+          l = n;
+          n = std::get<0>(nth(l, {}, n->s_ / 2));
+          r = split(l, n->key(), cmp, fix);
+
+          {
+            auto const [m, mp](first_node(r, {}));
+            unlink(r, m, mp);
+          }
+
+          for (auto const m: {l, r})
+          {
+            if (m)
+            {
+              auto const c(conv(n));
+              m->l_ ^= c; m->r_ ^= c;
+            }
+          }
+
+          fix(n, l, r);
+          assign(sl, sr)(size(l, n), size(r, n));
+        }
       }
 
-      //
-      if (auto const s(1 + sl + sr), S(2 * s);
-        (3 * sl > S) || (3 * sr > S))
+      // rebuilt subtrees keep their elements, n needs no fixing
+      sl < sr ?
+        void((r = f(f, r, n), l = f(f, l, n))) :
+        void((l = f(f, l, n), r = f(f, r, n)));
+
+      n->l_ = conv(l, p); n->r_ = conv(r, p);
+
+      return n;
+    }
+  );
+
+  r = f(f, r, {});
+
+  return b;
+}
+
+inline auto maybe_rebalance(auto& r, size_type const b, auto const& cmp)
+  noexcept
+{
+  return maybe_rebalance(r, b, cmp, fix_size,
+    [&](auto& r, auto const n, auto const p) noexcept
+    {
+      unlink(r, n, p, cmp);
+    }
+  );
+}
+
+inline void erase_range(auto& al, auto& r, auto const& lo, auto const* const hi,
+  auto const& cmp, auto const& fix, auto const& unlink) noexcept
+{ // cut the keys in [lo, hi) out as one subtree, the range is open without hi
+  auto m(split(r, lo, cmp, fix));
+  decltype(m) h{};
+
+  if (hi) h = split(m, *hi, cmp, fix);
+
+  destroy(al, m, {});
+  join(r, h, cmp, fix, unlink);
+}
+
+inline void erase_range(auto& al, auto& r, auto const& lo,
+  auto const* const hi, auto const& cmp) noexcept
+{
+  erase_range(al, r, lo, hi, cmp, fix_size,
+    [&](auto& r, auto const n, auto const p) noexcept
+    {
+      unlink(r, n, p, cmp);
+    }
+  );
+}
+
+
+inline void insert_batch(auto& al, auto& r, auto const i, decltype(i) j,
+  auto const& cmp, auto const& key, auto const& create, auto const& fix)
+{ // insert a sorted range in one top-down walk, partitioning it around every
+  // node passed, create(v, n) gets the elements equivalent to a node n; what
+  // reaches an empty subtree is built balanced, the topmost node to become a
+  // scapegoat is rebuilt once, after its part of the range went in
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  auto const f([&](auto&& f, node_t* const n, decltype(n) p,
+    decltype(i) i, decltype(i) const j, bool const chk) -> node_t*
+    {
+      if (i == j)
+      {
+        return n;
+      }
+      else if (!n)
       {
-        if (auto const nn(rebalance(n, p, q_, qp_, s)); p)
+        auto const m(build(al, i, j, create, fix));
+
+        if (m)
         {
-          d ? p->r_ = conv(nn, right_node(p, n)) :
-            p->l_ = conv(nn, left_node(p, n));
+          auto const pc(conv(p));
+          m->l_ ^= pc; m->r_ ^= pc;
         }
-        else
+
+        return m;
+      }
+
+      auto const a(std::partition_point(i, j, [&](auto&& v) noexcept
         {
-          r_ = nn;
+          return cmp(key(v), n->key()) < 0;
         }
+      ));
 
-        return {};
+      auto const b(std::partition_point(a, j, [&](auto&& v) noexcept
+        {
+          return cmp(key(v), n->key()) == 0;
+        }
+      ));
+
+      auto l(left_node(n, p)), r(right_node(n, p));
+      bool sg{};
+
+      if constexpr(Sized<node_t> && !Deferred<node_t>)
+      {
+        if (chk)
+        { // predict the sizes, equivalent keys do not count
+          sg = scapegoat<node_t>(size(l, n) + std::distance(i, a),
+            size(r, n) + std::distance(b, j));
+        }
+      }
+
+      try
+      {
+        for (auto k(a); k != b; ++k) create(*k, n);
+
+        n->l_ = conv(l = f(f, l, n, i, a, chk && !sg), p);
+        n->r_ = conv(r = f(f, r, n, b, j, chk && !sg), p);
+      }
+      catch (...)
+      {
+        fix(n, l, r);
+
+        throw;
+      }
+
+      if (sg)
+      {
+        node_t* qp;
+
+        return rebalance(n, p, {}, qp, fix);
       }
       else
       {
-        return s;
+        fix(n, l, r);
+
+        return n;
+      }
+    }
+  );
+
+  r = f(f, r, {}, i, j, true);
+}
+
+inline auto erase_batch(auto& r, auto const i, decltype(i) j,
+  auto const& cmp, auto const& key, auto const& fix, auto const& unlink,
+  auto const& erase) noexcept
+{ // erase the nodes with keys in a sorted range in one bottom-up walk, a
+  // node goes by joining its subtrees, a subtree with keys for most of its
+  // nodes is rebuilt instead, erase(n) frees a node and returns a count
+  using node_t = std::remove_pointer_t<std::remove_cvref_t<decltype(r)>>;
+
+  size_type e{};
+
+  auto const f([&](auto&& f, node_t* const n, decltype(n) p,
+    decltype(i) i, decltype(i) const j) noexcept -> node_t*
+    {
+      if ((i == j) || !n) return n;
+
+      if constexpr(Sized<node_t>)
+      {
+        if (2 * size_type(std::distance(i, j)) > n->s_)
+        { // keys for most of the nodes, filter the thread and rebuild it
+          node_t* h, *nh{}, *t{};
+          size_type sz, ns{};
+
+          std::tie(h, sz) = thread(n, p);
+
+          for (auto k(i); sz--;)
+          {
+            auto const m(h);
+            h = decltype(h)(h->l_ & ~std::uintptr_t(1));
+
+            for (; (k != j) && (cmp(key(*k), m->key()) < 0); ++k);
+
+            if ((k != j) && (cmp(key(*k), m->key()) == 0))
+            {
+              e += erase(m);
+            }
+            else
+            {
+              t ? void(t->l_ = conv(m)) : void(nh = m);
+              t = m; ++ns;
+            }
+          }
+
+          auto const m(ns ? build(nh, ns, fix) : nh);
+
+          if (m)
+          {
+            auto const pc(conv(p));
+            m->l_ ^= pc; m->r_ ^= pc;
+          }
+
+          return m;
+        }
+      }
+
+      auto const a(std::partition_point(i, j, [&](auto&& k) noexcept
+        {
+          return cmp(key(k), n->key()) < 0;
+        }
+      ));
+
+      auto const b(std::partition_point(a, j, [&](auto&& k) noexcept
+        {
+          return cmp(key(k), n->key()) == 0;
+        }
+      ));
+
+      auto const e0(e);
+      auto const l0(left_node(n, p)), r0(right_node(n, p));
+
+      auto l(f(f, l0, n, i, a)), r(f(f, r0, n, b, j));
+
+      if (a == b)
+      {
+        if ((e != e0) || (l != l0) || (r != r0))
+        { // something below changed
+          n->l_ = conv(l, p); n->r_ = conv(r, p);
+          fix(n, l, r);
+        }
+
+        return n;
+      }
+
+      // detach the subtrees from n, join them and hang the result from p
+      {
+        auto const nc(conv(n));
+
+        if (l) { l->l_ ^= nc; l->r_ ^= nc; }
+        if (r) { r->l_ ^= nc; r->r_ ^= nc; }
+      }
+
+      e += erase(n);
+      join(l, r, cmp, fix, unlink);
+
+      if (l)
+      {
+        auto const pc(conv(p));
+        l->l_ ^= pc; l->r_ ^= pc;
       }
+
+      return l;
     }
-  };
+  );
 
-  //
-  S s(r, k, create_node); s(r, {}, {});
+  r = f(f, r, {}, i, j);
 
-  return std::tuple(s.q_, s.qp_, s.s_);
+  return e;
+}
+
+inline auto erase_batch(auto& al, auto& r, auto const i, decltype(i) j,
+  auto const& cmp) noexcept
+{
+  return erase_batch(
+    r,
+    i,
+    j,
+    cmp,
+    [](auto&& k) noexcept -> auto& { return k; },
+    fix_size,
+    [&](auto& r, auto const n, auto const p) noexcept
+    {
+      unlink(r, n, p, cmp);
+    },
+    [&](auto const n) noexcept { delete_node(al, n); return size_type(1); }
+  );
 }
 
 }